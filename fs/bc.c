@@ -1,6 +1,35 @@
 
 #include "fs.h"
 
+// The block cache keeps at most BC_NBLOCKS blocks in memory.  Once it
+// is full, bc_pgfault makes room using the CLOCK algorithm: bc_hand 
+// sweeps around bc_blocks, giving each block used since the hand last
+// passed it (its PTE_A bit is set, or it was only just read in) a
+// second chance, and evicting the first one that wasn't.  Dirty
+// blocks are written out before they're evicted.  BC_NBLOCKS may be 
+// set at build time, and bc_set_limit lowers it at run time.
+#ifndef BC_NBLOCKS
+#define BC_NBLOCKS	1024
+#endif
+
+// A fault can be reading in a block, the bitmap block covering it and
+// the superblock all at once (see bc_pgfault), so the cache needs at
+// least one more slot than that.
+#define BC_MINBLOCKS	4
+
+static uint32_t bc_blocks[BC_NBLOCKS];	// block in each slot, or 0
+static bool bc_fresh[BC_NBLOCKS];	// read in since the hand passed?
+static bool bc_busy[BC_NBLOCKS];	// still being read in by bc_pgfault?
+static int bc_limit = BC_NBLOCKS;	// slots in use
+static int bc_hand;
+
+// The blocks written to since they were last written out, in ascending
+// order.  A cached block is mapped writable exactly while it is on this
+// list: the first write to a clean block faults, and bc_pgfault adds it
+// then.  So bc_sync costs O(dirty blocks), and writes them in disk order.
+static uint32_t bc_dirty[BC_NBLOCKS];
+static int bc_ndirty;
+
 // Return the virtual address of this disk block.
 void*
 diskaddr(uint32_t blockno)
@@ -10,6 +39,14 @@ diskaddr(uint32_t blockno)
 	return (char*) (DISKMAP + blockno * BLKSIZE);
 }
 
+// Like diskaddr, but without looking at the superblock, so it can't
+// fault while the cache is being rearranged.
+static void *
+bc_va(uint32_t blockno)
+{
+	return (char*) (DISKMAP + blockno * BLKSIZE);
+}
+
 // Is this virtual address mapped?
 bool
 va_is_mapped(void *va)
@@ -17,22 +54,184 @@ va_is_mapped(void *va)
 	return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
 }
 
-// Is this virtual address dirty?
+// The index of the first block in bc_dirty that's >= blockno.
+static int
+bc_dirty_index(uint32_t blockno)
+{
+	int lo = 0, hi = bc_ndirty, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (bc_dirty[mid] < blockno)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static bool
+block_is_dirty(uint32_t blockno)
+{
+	int i = bc_dirty_index(blockno);
+
+	return i < bc_ndirty && bc_dirty[i] == blockno;
+}
+
+// Is the block at this virtual address dirty?
 bool
 va_is_dirty(void *va)
 {
-	return (vpt[VPN(va)] & PTE_D) != 0;
+	return block_is_dirty(((uint32_t) va - DISKMAP) / BLKSIZE);
+}
+
+// Add blockno to the dirty blocks, first writing the others out if
+// there's no room for it.
+static void
+bc_set_dirty(uint32_t blockno)
+{
+	int i;
+
+	if (bc_ndirty == BC_NBLOCKS)
+		bc_sync();
+	i = bc_dirty_index(blockno);
+	if (i < bc_ndirty && bc_dirty[i] == blockno)
+		return;
+	memmove(&bc_dirty[i + 1], &bc_dirty[i], 
+		(bc_ndirty - i) * sizeof(bc_dirty[0]));
+	bc_dirty[i] = blockno;
+	bc_ndirty++;
+}
+
+static void
+bc_clear_dirty(uint32_t blockno)
+{
+	int i = bc_dirty_index(blockno);
+
+	if (i == bc_ndirty || bc_dirty[i] != blockno)
+		return;
+	bc_ndirty--;
+	memmove(&bc_dirty[i], &bc_dirty[i + 1],
+		(bc_ndirty - i) * sizeof(bc_dirty[0]));
+}
+
+// Write dirty block blockno out to disk, if it's in memory, and make
+// it read-only again, which also clears PTE_D.  The caller takes it
+// off bc_dirty.
+static void
+bc_write(uint32_t blockno)
+{
+	int r;
+	void *va = bc_va(blockno);
+
+	if (!va_is_mapped(va))
+		return;
+	if ((r = ide_write(blockno * BLKSECTS, va, BLKSECTS)) < 0)
+		panic("flush_block: %e\n", r);
+	if ((r = sys_page_map(0, va, 0, va, 
+			      vpt[VPN(va)] & PTE_USER & ~PTE_W)) < 0)
+		panic("flush_block: %e\n", r);
+}
+
+// Clear the PTE_A bit of the cached block at va.  Remapping the page 
+// clears PTE_D as well, but bc_dirty remembers whether it's dirty.
+static void
+bc_clear_accessed(void *va)
+{
+	int r;
+
+	if ((r = sys_page_map(0, va, 0, va, vpt[VPN(va)] & PTE_USER)) < 0)
+		panic("bc_clear_accessed: %e\n", r);
+}
+
+// Find a slot in bc_blocks for a block about to be read in, evicting
+// a block if the cache is full.  Blocks also mapped by clients (see 
+// serve_read_map) are passed over, since their pages stop showing
+// later writes to the file once we let go of them.  But if every 
+// cached block is mapped by a client, the block under the hand is 
+// evicted anyway: the clients keep their pages, and the block is read
+// back in from disk the next time we touch it.  So however many blocks
+// clients hold on to, the cache never grows past bc_limit.  Blocks
+// still being read in are never evicted, or a fault that has to read
+// in the bitmap or superblock too could evict the block it came for.
+// Returns the slot.
+static int
+bc_evict(void)
+{
+	int n, slot;
+	void *va;
+
+	for (n = 0; n < 2 * bc_limit + 1; n++) {
+		slot = bc_hand;
+		bc_hand = (bc_hand + 1) % bc_limit;
+		if (!bc_blocks[slot])
+			return slot;
+		if (bc_busy[slot])
+			continue;
+		va = bc_va(bc_blocks[slot]);
+		if (!va_is_mapped(va))
+			return slot;	// unmapped behind our back
+		if (pageref(va) > 1)
+			continue;
+		if (bc_fresh[slot] || (vpt[VPN(va)] & PTE_A)) {
+			bc_fresh[slot] = 0;
+			bc_clear_accessed(va);
+			continue;
+		}
+		flush_block(va);
+		sys_page_unmap(0, va);
+		bc_blocks[slot] = 0;
+		return slot;
+	}
+
+	do {
+		slot = bc_hand;
+		bc_hand = (bc_hand + 1) % bc_limit;
+	} while (bc_busy[slot]);
+	va = bc_va(bc_blocks[slot]);
+	flush_block(va);
+	sys_page_unmap(0, va);
+	bc_blocks[slot] = 0;
+	return slot;
+}
+
+// Keep at most n blocks in the cache from now on, evicting any in the
+// slots beyond n as bc_evict would, even if clients have them mapped.
+// n is clamped to [BC_MINBLOCKS, BC_NBLOCKS].
+void
+bc_set_limit(int n)
+{
+	int slot;
+	void *va;
+
+	n = MIN(MAX(n, BC_MINBLOCKS), BC_NBLOCKS);
+	for (slot = n; slot < bc_limit; slot++) {
+		if (!bc_blocks[slot])
+			continue;
+		va = bc_va(bc_blocks[slot]);
+		if (va_is_mapped(va)) {
+			flush_block(va);
+			sys_page_unmap(0, va);
+		}
+		bc_blocks[slot] = 0;
+	}
+	bc_limit = n;
+	if (bc_hand >= bc_limit)
+		bc_hand = 0;
 }
 
 // Fault any disk block that is read or written in to memory by
-// loading it from disk.
+// loading it from disk, evicting another block if the cache is full.
+// Blocks are mapped read-only until they are written to; a write to a
+// clean block also faults, and marks it dirty.
 // Hint: Use ide_read and BLKSECTS.
 static void
 bc_pgfault(struct UTrapframe *utf)
 {
 	void *addr = (void *) utf->utf_fault_va;
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
-	int r;
+	bool write = (utf->utf_err & FEC_WR) != 0;
+	int r, slot;
 
 	// Check that the fault was within the block cache region
 	if (addr < (void*)DISKMAP || addr >= (void*)(DISKMAP + DISKSIZE))
@@ -42,6 +241,17 @@ bc_pgfault(struct UTrapframe *utf)
 	// addr may not be aligned to block boundary
 	addr = ROUNDDOWN(addr, BLKSIZE);
 
+	// The first write to a clean block.
+	if (write && va_is_mapped(addr)) {
+		bc_set_dirty(blockno);
+		if ((r = sys_page_map(0, addr, 0, addr, 
+				      (vpt[VPN(addr)] & PTE_USER) | PTE_W)) < 0)
+			panic("bc_pgfault: %e\n", r);
+		return;
+	}
+
+	slot = bc_evict();
+
 	// Allocate a page in the disk map region and read the
 	// contents of the block from the disk into that page.
 	// NOTE: ide_read operates in sectors, not blocks.
@@ -49,6 +259,14 @@ bc_pgfault(struct UTrapframe *utf)
 		panic("bc_pgfault: %e\n", r);
 	if ((r = ide_read(blockno * BLKSECTS, addr, BLKSECTS)) < 0)
 		panic("bc_pgfault: %e\n", r);
+	// It stays writable only if it's about to be written.
+	if (write)
+		bc_set_dirty(blockno);
+	else if ((r = sys_page_map(0, addr, 0, addr, PTE_P|PTE_U)) < 0)
+		panic("bc_pgfault: %e\n", r);
+	bc_blocks[slot] = blockno;
+	bc_fresh[slot] = 1;
+	bc_busy[slot] = 1;
 
 	// Sanity check the block number. (exercise for the reader:
 	// why do we do this *after* reading the block in?)
@@ -58,38 +276,37 @@ bc_pgfault(struct UTrapframe *utf)
 	// Check that the block we read was allocated.
 	if (bitmap && block_is_free(blockno))
 		panic("reading free block %08x\n", blockno);
+	bc_busy[slot] = 0;
 }
 
 // Flush the contents of the block containing VA out to disk if
-// necessary, then clear the PTE_D bit using sys_page_map.
-// If the block is not in the block cache or is not dirty, does
-// nothing.
-// Hint: Use va_is_mapped, va_is_dirty, and ide_write.
-// Hint: Use the PTE_USER constant when calling sys_page_map.
-// Hint: Don't forget to round addr down.
+// necessary, and mark it clean.  If the block is not in the block cache
+// or is not dirty, does nothing.
 void
 flush_block(void *addr)
 {
-	int r;
 	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
 
 	if (addr < (void*)DISKMAP || (void*)(DISKMAP + DISKSIZE) <= addr) 
 		panic("flush_block of bad va %08x", addr);
 
-	// addr may not be aligned to block boundary
-	addr = ROUNDDOWN(addr, BLKSIZE);
-
-	// Write a block out to disk only if necessary. If the block isn't 
-	// in the block cache or isn't dirty we shouldn't do anything.
-	if (va_is_mapped(addr) && va_is_dirty(addr)) {
-		if ((r = ide_write(blockno * BLKSECTS, addr, BLKSECTS)) < 0)
-			panic("flush_block: %e\n", r);
-		// clear the PTE_D "dirty" bit
-		if ((r = sys_page_map(0, addr, 0, addr, PTE_USER)) < 0)
-			panic("flush_block: %e\n", r);
+	if (block_is_dirty(blockno)) {
+		bc_write(blockno);
+		bc_clear_dirty(blockno);
 	}
 }
 
+// Write every dirty block out to disk, in ascending order.
+void
+bc_sync(void)
+{
+	int i;
+
+	for (i = 0; i < bc_ndirty; i++)
+		bc_write(bc_dirty[i]);
+	bc_ndirty = 0;
+}
+
 // Test that the block cache works, by smashing the superblock and
 // reading it back.
 static void
@@ -479,24 +479,14 @@ file_set_size(struct File *f, off_t newsize)
 }
 
 // Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// The block cache only knows which blocks are dirty, not which file 
+// they belong to, so this writes out every dirty block: that costs 
+// O(dirty blocks), where walking the file's blocks to pick out its own
+// would cost O(file size).
 void
 file_flush(struct File *f)
 {
-	int i;
-	uint32_t *pdiskbno;
-
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
-		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
-			continue;
-		flush_block(diskaddr(*pdiskbno));
-	}
-	flush_block(f);
-	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+	bc_sync();
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -517,12 +507,10 @@ file_remove(const char *path)
 	return 0;
 }
 
-// Sync the entire file system.  A big hammer.
+// Sync the entire file system, writing out just the dirty blocks.
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+	bc_sync();
 }
 
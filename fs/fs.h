@@ -25,6 +25,8 @@ void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	bc_sync(void);
+void	bc_set_limit(int n);
 void	bc_init(void);
 
 /* fs.c */
@@ -41,6 +43,7 @@ void	fs_sync(void);
 
 /* int	map_block(uint32_t); */
 bool	block_is_free(uint32_t blockno);
+void	free_block(uint32_t blockno);
 int	alloc_block(void);
 
 /* test.c */
@@ -45,8 +45,25 @@ struct OpenFile opentab[MAXOPEN] = {
 	{ 0, 0, 1, 0 }
 };
 
-// Virtual address at which to receive page mappings containing client requests.
-union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// Virtual address at which to receive page mappings containing client requests,
+// followed by the pages of data for a multi-page write.
+union Fsipc *fsreq = (union Fsipc *)(DISKMAP - IPC_MAXPAGES * PGSIZE);
+#define REQPAGES	((char *) fsreq + PGSIZE)
+
+// Number of pages of data that came with the current request, at REQPAGES.
+static unsigned req_npages;
+
+// Pages to send along with the reply to the current request, with 
+// sys_ipc_send_pages, instead of the usual single page.
+static void *reply_pages[IPC_MAXPAGES];
+static unsigned reply_npages;
+static int reply_perm;
+static unsigned reply_staged;	// pages at READPAGES to unmap after replying
+static struct Fd *reply_seekfd;	// seek position to advance by reply_seek
+static size_t reply_seek;	// once the pages have been delivered
+
+// Where the pages of data for a multi-page read are put together.
+#define READPAGES	((char *) DISKMAP - 2 * IPC_MAXPAGES * PGSIZE)
 
 void
 serve_init(void)
@@ -193,10 +210,41 @@ serve_set_size(envid_t envid, struct Fsreq_set_size *req)
 	return file_set_size(o->o_file, req->req_size);
 }
 
+// Read up to n bytes of open file o, at its seek position, into fresh
+// pages to send with the reply, in one file_read.  The seek position 
+// moves on only if the client gets the pages.
+static int
+serve_read_pages(struct OpenFile *o, size_t n)
+{
+	int r;
+	unsigned i;
+	struct Pageop op;
+
+	n = MIN(n, FSREQ_MAXPAGES * PGSIZE);
+	op.po_op = PAGEOP_ALLOC;
+	op.po_dstva = READPAGES;
+	op.po_npages = ROUNDUP(n, PGSIZE) / PGSIZE;
+	op.po_perm = PTE_P | PTE_U | PTE_W;
+	if ((r = sys_page_batch(0, 0, &op, 1)) < 0)
+		return r;
+	reply_staged = ROUNDUP(n, PGSIZE) / PGSIZE;
+
+	if ((r = file_read(o->o_file, READPAGES, n, o->o_fd->fd_offset)) < 0)
+		return r;
+	for (i = 0; i < ROUNDUP(r, PGSIZE) / PGSIZE; i++)
+		reply_pages[reply_npages++] = READPAGES + i * PGSIZE;
+	reply_perm = PTE_P | PTE_U | PTE_W;
+	reply_seekfd = o->o_fd;
+	reply_seek = r;
+	return r;
+}
+
 // Read at most ipc->read.req_n bytes from the current seek position
 // in ipc->read.req_fileid.  Return the bytes read from the file to
-// the caller in ipc->readRet, then update the seek position.  Returns
-// the number of bytes successfully read, or < 0 on error.
+// the caller in ipc->readRet, or if req_n is more than that holds, in
+// up to FSREQ_MAXPAGES fresh pages sent with the reply, then update 
+// the seek position.  Returns the number of bytes successfully read, 
+// or < 0 on error.
 int
 serve_read(envid_t envid, union Fsipc *ipc)
 {
@@ -222,6 +270,9 @@ serve_read(envid_t envid, union Fsipc *ipc)
 	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
 		return r;
 
+	if (req->req_n > sizeof(ret->ret_buf))
+		return serve_read_pages(o, req->req_n);
+
 	// Don't read more than a page from the file.
 	size_t req_n = MIN(PGSIZE, req->req_n);
 
@@ -235,10 +286,111 @@ serve_read(envid_t envid, union Fsipc *ipc)
 	return r;
 }
 
+// Map the blocks holding at most req->req_n bytes of req->req_fileid, 
+// starting at req->req_offset, into the caller with permissions 
+// req->req_perm, rather than copying them through the request page.
+// The offset must be a multiple of BLKSIZE, and the seek position is 
+// left alone.  The pages are this server's block cache pages themselves,
+// so later writes to the file show through them, as long as the block
+// cache holds on to them (see bc_evict).  They are never sent
+// writable: the blocks may be freed by a truncate or remove while the
+// caller still has them, and be reused for another file or for metadata.
+// Clients that write to such pages write to copies, and send those back
+// with FSREQ_WRITE_BACK.  Returns the number of bytes mapped, or < 0 on
+// error.
+int
+serve_read_map(envid_t envid, struct Fsreq_read_map *req)
+{
+	int r;
+	struct OpenFile *o;
+	char *blk;
+	off_t pos;
+	size_t n;
+
+	if (debug)
+		cprintf("serve_read_map %08x %08x %08x %08x\n", envid, 
+			req->req_fileid, req->req_offset, req->req_n);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0 || req->req_offset % BLKSIZE != 0)
+		return -E_INVAL;
+	if (req->req_perm & PTE_W)
+		return -E_INVAL;
+	if (req->req_offset >= o->o_file->f_size)
+		return 0;
+
+	n = MIN(req->req_n, o->o_file->f_size - req->req_offset);
+	n = MIN(n, IPC_MAXPAGES * BLKSIZE);
+	for (pos = 0; pos < n; pos += BLKSIZE) {
+		if ((r = file_get_block(o->o_file, 
+				(req->req_offset + pos) / BLKSIZE, &blk)) < 0)
+			goto fail;
+		// Fault the block in so there's a page to send, and map it
+		// at READPAGES too, so that faulting in the next blocks
+		// can't evict it (see bc_evict) from under the reply.
+		if (!va_is_mapped(blk))
+			(void) *(volatile char *) blk;
+		if ((r = sys_page_map(0, blk, 0, READPAGES + reply_staged * PGSIZE,
+				      PTE_P | PTE_U)) < 0)
+			goto fail;
+		reply_pages[reply_npages++] = READPAGES + reply_staged * PGSIZE;
+		reply_staged++;
+	}
+	reply_perm = PTE_P | PTE_U | (req->req_perm & PTE_SHARE);
+	return n;
+
+fail:
+	reply_npages = 0;
+	return r;
+}
+
+// The caller changed its copies of pages it got from FSREQ_READ_MAP.
+// The request brings two sets of pages covering req->req_n bytes at
+// req->req_offset in req->req_fileid: the changed copies, then the
+// pages as they were when copied.  Write only the bytes that differ,
+// so changes other clients made to the file since are kept.
+// The seek position is left alone, and the file is not extended: bytes
+// past its end, for instance because it was truncated since, are
+// dropped.  Returns the number of bytes looked at, or < 0 on error.
+int
+serve_write_back(envid_t envid, struct Fsreq_write_back *req)
+{
+	int r;
+	struct OpenFile *o;
+	size_t i, j, n, npages = req_npages / 2;
+	char *new = REQPAGES, *old = REQPAGES + npages * PGSIZE;
+
+	if (debug)
+		cprintf("serve_write_back %08x %08x %08x %08x\n", envid, 
+			req->req_fileid, req->req_offset, req->req_n);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if ((o->o_mode & O_ACCMODE) == O_RDONLY || req->req_offset < 0)
+		return -E_INVAL;
+	if (req->req_offset >= o->o_file->f_size)
+		return 0;
+
+	n = MIN(req->req_n, npages * PGSIZE);
+	n = MIN(n, o->o_file->f_size - req->req_offset);
+	for (i = 0; i < n; i = j) {
+		for (; i < n && new[i] == old[i]; i++)
+			;
+		for (j = i; j < n && new[j] != old[j]; j++)
+			;
+		if (j > i && (r = file_write(o->o_file, new + i, j - i,
+					     req->req_offset + i)) < 0)
+			return r;
+	}
+	return n;
+}
+
 // Write req->req_n bytes from req->req_buf to req_fileid, starting at
 // the current seek position, and update the seek position
-// accordingly.  Extend the file if necessary.  Returns the number of
-// bytes written, or < 0 on error.
+// accordingly.  If pages of data came with the request, the bytes are
+// in those instead.  Extend the file if necessary.  Returns the number
+// of bytes written, or < 0 on error.
 int
 serve_write(envid_t envid, struct Fsreq_write *req)
 {
@@ -255,10 +407,15 @@ serve_write(envid_t envid, struct Fsreq_write *req)
 
 	// Don't write more than we can fill in the buffer.
 	size_t req_n = MIN(sizeof(req->req_buf), req->req_n);
+	char *buf = req->req_buf;
+	if (req_npages) {
+		req_n = MIN(req_npages * PGSIZE, req->req_n);
+		buf = REQPAGES;
+	}
 	
 	// Second, call the relevant file system function (from fs/fs.c).
 	// On failure, return the error code to the client.
-	if ((r = file_write(o->o_file, req->req_buf, req_n, o->o_fd->fd_offset)) < 0)
+	if ((r = file_write(o->o_file, buf, req_n, o->o_fd->fd_offset)) < 0)
 		return r;
 
 	// Update the seek position and return the number of bytes written.
@@ -344,20 +501,27 @@ fshandler handlers[] = {
 	[FSREQ_STAT] =		serve_stat,
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_REMOVE] =	(fshandler)serve_remove,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_READ_MAP] =	(fshandler)serve_read_map,
+	[FSREQ_WRITE_BACK] =	(fshandler)serve_write_back
 };
 #define NHANDLERS (sizeof(handlers)/sizeof(handlers[0]))
 
 void
 serve(void)
 {
-	uint32_t req, whom;
-	int perm, r;
-	void *pg;
+	uint32_t req, whom = 0;
+	int perm = 0, r = 0;
+	void *pg = NULL;
+	struct Pageop op;
 
 	while (1) {
-		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
+		// Reply to the previous request, if any, and wait for the next 
+		// one in a single system call. The kernel switches straight back
+		// to the client we replied to if no other request is waiting.
+		req = ipc_reply_wait(whom, r, pg, perm, (envid_t *) &whom, 
+				     IPC_NPAGES(fsreq, 1 + FSREQ_MAXPAGES), &perm);
+		req_npages = env->env_ipc_npages ? env->env_ipc_npages - 1 : 0;
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, vpt[VPN(fsreq)], fsreq);
@@ -366,6 +530,7 @@ serve(void)
 		if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
+			whom = 0;
 			continue; // just leave it hanging...
 		}
 
@@ -378,8 +543,34 @@ serve(void)
 			cprintf("Invalid request code %d from %08x\n", whom, req);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
+
+		// Send a multi-page reply on its own; the client is blocked
+		// waiting for it, so it can't need queueing.
+		if (reply_npages) {
+			if ((r = sys_ipc_send_pages(whom, r, reply_pages, 
+					reply_npages, reply_perm)) >= 0) {
+				whom = 0;
+				if (reply_seekfd)
+					reply_seekfd->fd_offset += reply_seek;
+			}
+			reply_npages = 0;
+		}
+		reply_seekfd = NULL;
+
+		// Drop our mappings of the data pages that came with the
+		// request and of those staged for the reply.
+		op.po_op = PAGEOP_UNMAP;
+		if (req_npages) {
+			op.po_dstva = REQPAGES;
+			op.po_npages = req_npages;
+			sys_page_batch(0, 0, &op, 1);
+		}
+		if (reply_staged) {
+			op.po_dstva = READPAGES;
+			op.po_npages = reply_staged;
+			sys_page_batch(0, 0, &op, 1);
+			reply_staged = 0;
+		}
 	}
 }
 
@@ -390,6 +581,9 @@ umain(void)
 	binaryname = "fs";
 	cprintf("FS is running\n");
 
+	// Run ahead of CPU-bound environments when a request arrives.
+	sys_env_set_priority(0, ENV_PRIO_SERVER);
+
 	// Check that we are able to do I/O
 	outw(0x8A00, 0x8A00);
 	cprintf("FS can do I/O\n");
@@ -6,13 +6,56 @@
 
 static char *msg = "This is the NEW message of the day!\n\n";
 
+// Where fs_test maps cache blocks to pin them.
+#define PINVA	((char *) (2 * PGSIZE))
+#define NPIN	10
+
+// The number of blocks in the block cache.
+static int
+bc_count(uint32_t nblocks)
+{
+	uint32_t b;
+	int n = 0;
+
+	for (b = 1; b < nblocks; b++)
+		if (va_is_mapped((char *) DISKMAP + b * BLKSIZE))
+			n++;
+	return n;
+}
+
+// The next allocated block after b, past the superblock and bitmap,
+// wrapping around at the end of the disk.
+static uint32_t
+next_block(uint32_t b, uint32_t nblocks)
+{
+	uint32_t first = 2 + (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
+
+	do
+		b = (b + 1 >= first && b + 1 < nblocks) ? b + 1 : first;
+	while (block_is_free(b));
+	return b;
+}
+
+// Pin block b in the cache by mapping it at PINVA + i pages too.
+static void
+pin_block(uint32_t b, int i)
+{
+	int r;
+
+	(void) *(volatile char *) diskaddr(b);
+	if ((r = sys_page_map(0, diskaddr(b), 0, PINVA + i * PGSIZE, 
+			      PTE_P|PTE_U)) < 0)
+		panic("pin_block: %e", r);
+}
+
 void
 fs_test(void)
 {
 	struct File *f;
-	int r;
+	int r, i;
 	char *blk;
 	uint32_t *bits;
+	uint32_t b, nblocks, scratch, pinned[NPIN], dirty[3];
 
 	// back up bitmap
 	if ((r = sys_page_alloc(0, (void*) PGSIZE, PTE_P|PTE_U|PTE_W)) < 0)
@@ -65,4 +108,79 @@ fs_test(void)
 	assert(!(vpt[VPN(blk)] & PTE_D));
 	assert(!(vpt[VPN(f)] & PTE_D));
 	cprintf("file rewrite is good\n");
+
+	// Shrink the cache to 8 blocks.  A block mapped elsewhere stays
+	// cached while other blocks come and go.
+	nblocks = super->s_nblocks;
+	bc_set_limit(8);
+	assert(bc_count(nblocks) <= 8);
+	pinned[0] = b = next_block(0, nblocks);
+	pin_block(b, 0);
+	for (i = 0; i < 16; i++) {
+		b = next_block(b, nblocks);
+		(void) *(volatile char *) diskaddr(b);
+	}
+	assert(va_is_mapped(diskaddr(pinned[0])));
+	assert(bc_count(nblocks) <= 8);
+
+	// Pin more blocks than fit, the superblock and bitmap among them.
+	// Blocks are evicted anyway, but their pins keep their data.
+	pinned[1] = 1;
+	pinned[2] = 2;
+	for (i = 3; i < NPIN; i++)
+		pinned[i] = b = next_block(b, nblocks);
+	for (i = 1; i < NPIN; i++)
+		pin_block(pinned[i], i);
+	assert(bc_count(nblocks) <= 8);
+	for (i = 0; i < NPIN; i++)
+		if (memcmp(PINVA + i * PGSIZE, diskaddr(pinned[i]), BLKSIZE) != 0)
+			panic("pinned block %08x changed", pinned[i]);
+	assert(bc_count(nblocks) <= 8);
+
+	for (i = 0; i < NPIN; i++)
+		sys_page_unmap(0, PINVA + i * PGSIZE);
+	bc_set_limit(DISKSIZE / BLKSIZE);
+	cprintf("block cache limit is good\n");
+
+	// Dirty three blocks out of order.  Flushing one leaves the others
+	// dirty, and bc_sync cleans them all and makes them read-only.
+	dirty[0] = next_block(0, nblocks);
+	dirty[1] = next_block(dirty[0], nblocks);
+	dirty[2] = next_block(dirty[1], nblocks);
+	assert(dirty[0] < dirty[1] && dirty[1] < dirty[2]);
+	for (i = 0; i < 3; i++) {
+		blk = diskaddr(dirty[(i + 2) % 3]);
+		*(volatile char*)blk = *(volatile char*)blk;
+	}
+	for (i = 0; i < 3; i++)
+		assert(va_is_dirty(diskaddr(dirty[i])));
+	flush_block(diskaddr(dirty[1]));
+	assert(va_is_dirty(diskaddr(dirty[0])));
+	assert(!va_is_dirty(diskaddr(dirty[1])));
+	assert(va_is_dirty(diskaddr(dirty[2])));
+	bc_sync();
+	for (i = 0; i < 3; i++) {
+		assert(!va_is_dirty(diskaddr(dirty[i])));
+		assert(!(vpt[VPN(diskaddr(dirty[i]))] & PTE_W));
+	}
+
+	// A dirty block is written out when it is evicted.
+	if ((r = alloc_block()) < 0)
+		panic("alloc_block 2: %e", r);
+	scratch = r;
+	bc_set_limit(8);
+	blk = diskaddr(scratch);
+	for (i = 0; i < BLKSIZE; i++)
+		blk[i] = i % 251;
+	for (i = 0, b = 0; i < 32; i++)
+		if ((b = next_block(b, nblocks)) != scratch)
+			(void) *(volatile char *) diskaddr(b);
+	assert(!va_is_mapped(blk));
+	for (i = 0; i < BLKSIZE; i++)
+		if (blk[i] != (char) (i % 251))
+			panic("evicted dirty block lost its data at %d", i);
+	bc_set_limit(DISKSIZE / BLKSIZE);
+	free_block(scratch);
+	flush_block(&bitmap[scratch / 32]);
+	cprintf("dirty block tracking is good\n");
 }
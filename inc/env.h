@@ -34,14 +34,69 @@ typedef int32_t envid_t;
 #define ENV_FREE		0
 #define ENV_RUNNABLE		1
 #define ENV_NOT_RUNNABLE	2
+#define ENV_DYING		3	// destroyed while running on another CPU
+
+// Scheduling priority levels; 0 is the highest. An environment runs at
+// its base priority level env_prio or, after using up its quantum, at a 
+// lower one. Blocking in IPC brings it back to env_prio.
+#define ENV_NPRIO		4
+#define ENV_PRIO_SERVER		0	// servers that must answer promptly
+#define ENV_PRIO_DEFAULT	1
+
+// Number of IPC messages that can wait for an environment that is
+// not blocked in sys_ipc_recv when they are sent.
+#define IPCQSIZE		8
+
+// A receiver willing to take up to n pages in one message, mapped one
+// after another from dstva, passes IPC_NPAGES(dstva, n) as its dstva.
+// sys_ipc_send_pages sends them.
+#define IPC_MAXPAGES		64
+#define IPC_NPAGES(va, n)	((void *) ((uintptr_t) (va) | ((n) - 1)))
+
+// An IPC message queued for an environment.
+struct Ipcmsg {
+	envid_t im_from;		// envid of the sender
+	uint32_t im_value;		// data value sent
+	struct Page *im_page;		// page sent, with a reference, or NULL
+	unsigned im_npages;		// pages sent; if more than one, im_page
+					// is a page holding their struct Page *s
+	int im_perm;			// perm to map the pages with
+};
+
+// Where an environment's time went, in TSC cycles, and how often it
+// gave up the CPU. env_account keeps the times up to date.
+struct Envstat {
+	uint64_t es_run;		// cycles spent running
+	uint64_t es_wait;		// cycles spent runnable, waiting for a CPU
+	uint64_t es_block;		// cycles spent not runnable
+	uint32_t es_vswitch;		// times it blocked or yielded the CPU
+	uint32_t es_ivswitch;		// times another env was given its CPU
+	uint32_t es_syscalls;		// system calls made
+};
 
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	LIST_ENTRY(Env) env_link;	// Free list link pointers
+	TAILQ_ENTRY(Env) env_runlink;	// Run queue link pointers
 	envid_t env_id;			// Unique environment identifier
 	envid_t env_parent_id;		// env_id of this env's parent
 	unsigned env_status;		// Status of the environment
 	uint32_t env_runs;		// Number of times environment has run
+	int env_cpunum;			// The CPU whose run queue the env is on
+
+	// Scheduling
+	int env_prio;			// Base priority level
+	bool env_server;		// a server started by the kernel, which
+					// may set any env's priority
+	int env_level;			// Current priority level, >= env_prio
+	int env_ticks;			// Clock ticks used of the current quantum
+	bool env_preempted;		// the scheduler is taking the CPU away
+	LIST_ENTRY(Env) env_timerlink;	// Timer wheel link pointers
+	uint32_t env_timeout;		// Tick to wake up at, or 0 if none
+
+	// Accounting
+	struct Envstat env_stat;	// Time and switch counts
+	uint64_t env_stat_tsc;		// TSC when env_stat was last updated
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
@@ -56,6 +111,15 @@ struct Env {
 	uint32_t env_ipc_value;		// data value sent to us 
 	envid_t env_ipc_from;		// envid of the sender	
 	int env_ipc_perm;		// perm of page mapping received
+	unsigned env_ipc_maxpages;	// number of pages to accept at dstva
+	unsigned env_ipc_npages;	// number of pages received
+	envid_t env_ipc_waitfrom;	// if set, only accept a message from it
+	struct Ipcmsg env_ipc_queue[IPCQSIZE]; // messages sent while not recving
+	int env_ipc_qhead;		// index of the oldest queued message
+	int env_ipc_qcount;		// number of queued messages
+
+	// Shared packet rings
+	bool env_ring_waiting;		// env is blocked in sys_ring_wait
 };
 
 #endif // !JOS_INC_ENV_H
@@ -24,7 +24,8 @@
 #define E_FILE_EXISTS	13	// File already exists
 #define E_NOT_EXEC	14	// File not a valid executable
 #define E_NOT_SUPP	15	// Operation not supported
+#define E_TIMEOUT	16	// Timed out waiting
 
-#define MAXERROR	15
+#define MAXERROR	16
 
 #endif	// !JOS_INC_ERROR_H */
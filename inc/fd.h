@@ -60,4 +60,9 @@ int	dev_lookup(int devid, struct Dev **dev_store);
 extern struct Dev devfile;
 extern struct Dev devsock;
 
+int	devfile_flush(struct Fd *fd);
+ssize_t	devfile_map(struct Fd *fd, off_t offset, void *dstva, size_t n, int perm);
+ssize_t	devfile_write_back(struct Fd *fd, off_t offset, void *srcva,
+			   void *origva, size_t n);
+
 #endif	// not JOS_INC_FD_H
@@ -5,6 +5,7 @@
 
 #include <inc/types.h>
 #include <inc/mmu.h>
+#include <inc/env.h>
 
 // File nodes (both in-memory and on-disk)
 
@@ -60,17 +61,30 @@ struct Super {
 };
 
 // Definitions for requests from clients to file system
+
+// A read or write of more than fits in the request page moves its data 
+// in up to this many whole pages: for a read, sent back with the reply
+// to the dstva the client receives at, and for a write, sent with the
+// request page as IPC_NPAGES(request page, 1 + number of data pages).
+#define FSREQ_MAXPAGES	(IPC_MAXPAGES - 1)
+
 enum {
 	FSREQ_OPEN = 1,
 	FSREQ_SET_SIZE,
-	// Read returns a Fsret_read on the request page
+	// Read returns a Fsret_read on the request page, or pages of data
+	// if req_n is larger than that
 	FSREQ_READ,
 	FSREQ_WRITE,
 	// Stat returns a Fsret_stat on the request page
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Read_map replies with the file's block-cache pages themselves,
+	// mapped at the dstva the client receives at
+	FSREQ_READ_MAP,
+	// Write_back is sent with IPC_NPAGES(request page, 1 + data pages)
+	FSREQ_WRITE_BACK
 };
 
 union Fsipc {
@@ -108,6 +122,17 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_read_map {
+		int req_fileid;
+		off_t req_offset;
+		size_t req_n;
+		int req_perm;	// PTE_P|PTE_U, optionally PTE_SHARE
+	} read_map;
+	struct Fsreq_write_back {
+		int req_fileid;
+		off_t req_offset;
+		size_t req_n;
+	} write_back;
 };
 
 #endif /* !JOS_INC_FS_H */
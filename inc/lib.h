@@ -22,6 +22,7 @@
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
+#include <inc/time.h>
 
 #define USED(x)		(void)(x)
 
@@ -30,10 +31,12 @@ extern char *binaryname;
 extern volatile struct Env *env;
 extern volatile struct Env envs[NENV];
 extern volatile struct Page pages[];
+extern volatile struct Timepage timepage;
 void	exit(void);
 
 // pgfault.c
 void	set_pgfault_handler(void (*handler)(struct UTrapframe *utf));
+void	add_pgfault_handler(int (*claim)(struct UTrapframe *utf));
 
 // readline.c
 char*	readline(const char *buf);
@@ -45,18 +48,40 @@ envid_t	sys_getenvid(void);
 int	sys_env_destroy(envid_t);
 void	sys_yield(void);
 static envid_t sys_exofork(void);
+envid_t	sys_fork(void);
 int	sys_env_set_status(envid_t env, int status);
+int	sys_env_set_priority(envid_t env, int prio);
+int	sys_env_stat(envid_t env, struct Envstat *st);
 int	sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
 int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
 int	sys_page_alloc(envid_t env, void *pg, int perm);
+int	sys_page_alloc_super(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
+int	sys_page_batch(envid_t src_env, envid_t dst_env,
+		       struct Pageop *ops, unsigned nops);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_send_pages(envid_t to_env, uint32_t value, void **pgs,
+			   unsigned npages, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_until(void *rcv_pg, unsigned int msec);
+int	sys_ipc_call(envid_t to_env, uint32_t value, void *pg, int perm, 
+		     void *rcv_pg);
+int	sys_ipc_reply_wait(envid_t to_env, uint32_t value, void *pg, int perm,
+			   void *rcv_pg);
 unsigned int sys_time_msec(void);
+int sys_sleep_until(unsigned int msec);
 int sys_xmit_frame(const char *data, uint16_t len);
 int sys_rx(char *data);
+int sys_rx_wait(char *data);
+int sys_rx_batch(void *va, int max);
+int sys_rx_map(void *dstva);
+int sys_xmit_frags(struct jif_sg *sg);
+int sys_xmit_wait(const char *data, uint16_t len);
+int sys_rx_ring(struct jif_ring *ring);
+int sys_ring_wait(struct jif_ring *ring);
+int sys_ring_notify(envid_t envid);
 
 // This must be inlined.  Exercise for reader: why?
 static __inline envid_t sys_exofork(void) __attribute__((always_inline));
@@ -75,9 +100,19 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+		       unsigned int msec);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, int perm, 
+		 void *rcv_pg, int *perm_store);
+int32_t ipc_reply_wait(envid_t to_env, uint32_t value, void *pg, int perm,
+		       envid_t *from_env_store, void *rcv_pg, int *perm_store);
+
+// time.c
+unsigned int time_msec(void);
+uint64_t time_usec(void);
+uint64_t time_nsec(void);
 
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
 envid_t	sfork(void);	// Challenge!
 
@@ -95,9 +130,23 @@ int	stat(const char *path, struct Stat *statbuf);
 // file.c
 int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
+ssize_t	read_map(int fd, off_t offset, void *dstva, size_t n);
 int	remove(const char *path);
 int	sync(void);
 
+// mmap.c
+// Writes to a MAP_SHARED mapping stay in this environment (and those
+// sharing the pages with it through fork) until msync or munmap, which
+// write back just the bytes changed.  Until then other environments
+// don't see them; pages not written to show others' writes to the file.
+#define	PROT_READ	0x1		/* pages can be read */
+#define	PROT_WRITE	0x2		/* pages can be written */
+#define	MAP_SHARED	0x1		/* writes change the file */
+#define	MAP_PRIVATE	0x2		/* writes are private */
+int	mmap(void **addr, size_t len, int prot, int flags, int fd, off_t offset);
+int	munmap(void *addr, size_t len);
+int	msync(void *addr, size_t len);
+
 // pageref.c
 int	pageref(void *addr);
 
@@ -4,6 +4,7 @@
 #define JOS_INC_NS_H
 
 #include <inc/types.h>
+#include <inc/mmu.h>
 #include <lwip/sockets.h>
 
 struct jif_pkt {
@@ -11,6 +12,116 @@ struct jif_pkt {
 	char jp_data[0];
 };
 
+// A page may carry several packets packed back to back as jif_pkt
+// records, each one starting on a 4-byte boundary. A record with a
+// zero jp_len, or the end of the page, terminates the list.
+#define JIF_PKT_NEXT(pkt)						\
+	((struct jif_pkt *) ((char *) (pkt) +				\
+		ROUNDUP(sizeof(struct jif_pkt) + (pkt)->jp_len, 4)))
+
+// Pages mapped by sys_rx_map hold the frame exactly where the E100 
+// received it, in a receive frame descriptor. The struct jif_pkt sits 
+// JIF_RFD_PKTOFF bytes into the page, right in front of the frame data.
+#define JIF_RFD_PKTOFF	12
+
+// Scatter-gather transmit request for sys_xmit_frags. The frame is the
+// concatenation of the fragments, which the E100 reads straight out of
+// the caller's pages. They must not be modified until the frame is sent,
+// i.e. until the kernel reports an sg_done past the frame's sg_seq.  A
+// request with no fragments just reports sg_done.
+#define JIF_SG_MAXFRAGS	8
+
+struct jif_sg {
+	int sg_nfrags;
+	struct jif_frag {
+		void *jf_va;
+		int jf_len;
+	} sg_frags[JIF_SG_MAXFRAGS];
+	uint32_t sg_seq;	// set by the kernel: sequence number of the frame
+	uint32_t sg_done;	// set by the kernel: number of frames sent so far
+};
+
+// Single-producer/single-consumer packet ring in pages shared between two 
+// environments, or between the kernel and an environment. Packets flow 
+// through it without any system calls while neither side has to wait.
+//
+// Only the producer writes jr_head and the slots it fills, and only the 
+// consumer writes jr_tail, so no locking is needed. A consumer that finds 
+// the ring empty sets jr_waiting and sleeps in sys_ring_wait; the producer 
+// rings the doorbell with sys_ring_notify only if it sees jr_waiting after
+// making the ring non-empty, i.e. only on empty to non-empty transitions.
+// Likewise a producer that finds the ring full sets jr_prodwait and sleeps
+// in sys_ring_wait, and the consumer rings its doorbell after making room.
+#define JIF_RING_SLOTSIZE	2048
+#define JIF_RING_NSLOTS		32
+#define JIF_RING_PAGES		(1 + JIF_RING_NSLOTS * JIF_RING_SLOTSIZE / PGSIZE)
+
+struct jif_ring {
+	volatile uint32_t jr_head;	// number of slots filled by the producer
+	volatile uint32_t jr_tail;	// number of slots emptied by the consumer
+	volatile uint32_t jr_waiting;	// the consumer is asleep in sys_ring_wait
+	volatile uint32_t jr_prodwait;	// the producer is asleep in sys_ring_wait
+	uint32_t jr_drops;		// packets the producer dropped, ring full
+	char jr_pad[PGSIZE - 5 * sizeof(uint32_t)];
+	// Each slot holds a struct jif_pkt
+	char jr_slots[JIF_RING_NSLOTS][JIF_RING_SLOTSIZE];
+};
+
+// Virtual addresses at which the network server environments map rings.
+// The kernel produces into JIF_RXRING for ns_input, the core network 
+// server produces into JIF_TXRING for ns_output.
+#define JIF_RXRING	((struct jif_ring *) 0x10100000)
+#define JIF_TXRING	((struct jif_ring *) 0x10200000)
+
+// Order the stores before a ring update against the loads after it, 
+// which x86 may otherwise reorder.
+static __inline void
+jif_ring_mb(void)
+{
+	__asm __volatile("lock; addl $0,0(%%esp)" : : : "memory");
+}
+
+// Producer: return the slot to fill next, or NULL if the ring is full.
+static __inline struct jif_pkt *
+jif_ring_prod(struct jif_ring *r)
+{
+	if (r->jr_head - r->jr_tail == JIF_RING_NSLOTS)
+		return NULL;
+	return (struct jif_pkt *) r->jr_slots[r->jr_head % JIF_RING_NSLOTS];
+}
+
+// Producer: publish the slot returned by jif_ring_prod.
+// Returns non-zero if the consumer has to be woken up.
+static __inline int
+jif_ring_push(struct jif_ring *r)
+{
+	jif_ring_mb();
+	r->jr_head++;
+	jif_ring_mb();
+	return r->jr_waiting;
+}
+
+// Consumer: return the next slot to empty, or NULL if the ring is empty.
+static __inline struct jif_pkt *
+jif_ring_cons(struct jif_ring *r)
+{
+	if (r->jr_head == r->jr_tail)
+		return NULL;
+	jif_ring_mb();
+	return (struct jif_pkt *) r->jr_slots[r->jr_tail % JIF_RING_NSLOTS];
+}
+
+// Consumer: hand the slot returned by jif_ring_cons back to the producer.
+// Returns non-zero if the producer has to be woken up.
+static __inline int
+jif_ring_pop(struct jif_ring *r)
+{
+	jif_ring_mb();
+	r->jr_tail++;
+	jif_ring_mb();
+	return r->jr_prodwait;
+}
+
 // Definitions for requests from clients to network server
 enum {
 	// The following messages pass a page containing an Nsipc.
@@ -27,9 +138,13 @@ enum {
 	NSREQ_SOCKET,
 
 	// The following two messages pass a page containing a struct jif_pkt
+	// NSREQ_INPUT may pack several of them into the page (see JIF_PKT_NEXT)
 	NSREQ_INPUT,
+	// NSREQ_INPUT_RFD passes a page mapped by sys_rx_map (see JIF_RFD_PKTOFF)
+	NSREQ_INPUT_RFD,
 	// NSREQ_OUTPUT, unlike all other messages, is sent *from* the
-	// network server, to the output environment
+	// network server, to the output environment. It passes no page; 
+	// it says JIF_TXRING is mapped, after which packets go through it.
 	NSREQ_OUTPUT,
 
 	// The following message passes no page
@@ -96,6 +211,11 @@ union Nsipc {
 	} socket;
 
 	struct jif_pkt pkt;
+
+	struct Nsreq_input_rfd {
+		char req_rfd[JIF_RFD_PKTOFF];
+		struct jif_pkt req_pkt;
+	} inputRfd;
 };
 
 #endif // !JOS_INC_NS_H
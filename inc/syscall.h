@@ -9,19 +9,56 @@ enum
 	SYS_getenvid,
 	SYS_env_destroy,
 	SYS_page_alloc,
+	SYS_page_alloc_super,
 	SYS_page_map,
 	SYS_page_unmap,
+	SYS_page_batch,
 	SYS_exofork,
+	SYS_fork,
 	SYS_env_set_status,
+	SYS_env_set_priority,
+	SYS_env_stat,
 	SYS_env_set_trapframe,
 	SYS_env_set_pgfault_upcall,
 	SYS_yield,
 	SYS_ipc_try_send,
+	SYS_ipc_send_pages,
 	SYS_ipc_recv,
+	SYS_ipc_recv_until,
+	SYS_ipc_call,
+	SYS_ipc_reply_wait,
 	SYS_time_msec,
+	SYS_sleep_until,
 	SYS_xmit_frame,
 	SYS_rx,
+	SYS_rx_wait,
+	SYS_rx_batch,
+	SYS_rx_map,
+	SYS_xmit_frags,
+	SYS_xmit_wait,
+	SYS_rx_ring,
+	SYS_ring_wait,
+	SYS_ring_notify,
 	NSYSCALLS
 };
 
+// Page operations for sys_page_batch.  Each applies to po_npages
+// consecutive pages, in the batch's destination environment starting
+// at po_dstva, with the pages mapped coming from its source environment
+// starting at po_srcva.
+enum
+{
+	PAGEOP_ALLOC = 0,	// like sys_page_alloc(dstenv, dstva, perm)
+	PAGEOP_MAP,		// like sys_page_map(srcenv, srcva, dstenv, dstva, perm)
+	PAGEOP_UNMAP,		// like sys_page_unmap(dstenv, dstva)
+};
+
+struct Pageop {
+	int po_op;		// PAGEOP_*
+	void *po_srcva;		// first page to map, for PAGEOP_MAP
+	void *po_dstva;		// first page to change
+	unsigned po_npages;	// number of pages; 0 once done
+	int po_perm;		// permissions, for PAGEOP_ALLOC and PAGEOP_MAP
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
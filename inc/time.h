@@ -0,0 +1,33 @@
+// See COPYRIGHT for copyright information.
+
+#ifndef JOS_INC_TIME_H
+#define JOS_INC_TIME_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// The kernel's clock, mapped read-only into every environment at UTIME
+// so that user code can read the time without a system call.
+struct Timepage {
+	uint64_t tp_tsc_boot;		// TSC when the clock started
+	uint32_t tp_tsc_khz;		// TSC frequency in kHz, 0 if unknown
+	volatile uint32_t tp_msec;	// milliseconds since the clock started,
+					// as of the last timer tick
+};
+
+// Nanoseconds since the clock started, from the TSC if it was 
+// calibrated and from the last tick otherwise.
+static __inline uint64_t
+timepage_nsec(const volatile struct Timepage *tp)
+{
+	uint64_t cycles, hz;
+
+	if (tp->tp_tsc_khz == 0)
+		return (uint64_t) tp->tp_msec * 1000000;
+	// Split off whole seconds so cycles * 10^9 can't overflow.
+	cycles = read_tsc() - tp->tp_tsc_boot;
+	hz = (uint64_t) tp->tp_tsc_khz * 1000;
+	return (cycles / hz) * 1000000000 + (cycles % hz) * 1000000000 / hz;
+}
+
+#endif	// !JOS_INC_TIME_H
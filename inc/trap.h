@@ -36,6 +36,7 @@
 #define IRQ_SPURIOUS     7
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_TLB         20	// TLB shootdown IPI between CPUs
 
 #ifndef __ASSEMBLER__
 
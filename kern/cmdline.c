@@ -0,0 +1,62 @@
+// Kernel boot parameters.
+//
+// A multiboot boot loader such as GRUB passes the kernel a command line
+// like "/jos-grub e100.cbl=64 e100.rfa=128". The parameters are simple
+// name=value pairs separated by spaces. When the kernel was not booted
+// by a multiboot loader (e.g. by the JOS boot loader) there is no command
+// line and every parameter takes its default value.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+
+#include <kern/cmdline.h>
+
+#define CMDLINE_SIZE	256
+
+static char cmdline[CMDLINE_SIZE];
+
+//
+// Save a copy of the boot loader's command line, if it passed us one.
+// Must be called before the memory the boot loader left the command 
+// line in is handed to the page allocator.
+//
+void
+cmdline_init(uint32_t mbmagic, physaddr_t mbinfo)
+{
+	struct multiboot_info *mi;
+
+	if (mbmagic != MULTIBOOT_BOOTLOADER_MAGIC)
+		return;
+
+	// Physical memory is mapped at KERNBASE, both by the segments set up 
+	// in entry.S and later by the page tables built in i386_vm_init.
+	mi = (struct multiboot_info *) (mbinfo + KERNBASE);
+	if (!(mi->mi_flags & MULTIBOOT_INFO_CMDLINE))
+		return;
+
+	strncpy(cmdline, (char *) (mi->mi_cmdline + KERNBASE), CMDLINE_SIZE-1);
+	cprintf("Kernel command line: %s\n", cmdline);
+}
+
+//
+// Return the integer value of boot parameter 'name', 
+// or 'defval' if it was not given on the command line.
+//
+int
+cmdline_int(const char *name, int defval)
+{
+	char *p = cmdline;
+	size_t len = strlen(name);
+
+	while (*p) {
+		// Skip to the start of the next parameter.
+		while (*p == ' ')
+			p++;
+		if (strncmp(p, name, len) == 0 && p[len] == '=')
+			return strtol(p + len + 1, NULL, 0);
+		while (*p && *p != ' ')
+			p++;
+	}
+	return defval;
+}
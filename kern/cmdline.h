@@ -0,0 +1,26 @@
+#ifndef JOS_KERN_CMDLINE_H
+#define JOS_KERN_CMDLINE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Value left in %eax by a multiboot compliant boot loader.
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+// Flag in the multiboot info structure saying mi_cmdline is valid.
+#define MULTIBOOT_INFO_CMDLINE		(1<<2)
+
+// The part of the multiboot information structure we care about.
+struct multiboot_info {
+	uint32_t mi_flags;
+	uint32_t mi_mem_lower;
+	uint32_t mi_mem_upper;
+	uint32_t mi_boot_device;
+	uint32_t mi_cmdline;	// physical address of the command line
+};
+
+void cmdline_init(uint32_t mbmagic, physaddr_t mbinfo);
+int cmdline_int(const char *name, int defval);
+
+#endif	// !JOS_KERN_CMDLINE_H
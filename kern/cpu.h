@@ -0,0 +1,58 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_CPU_H
+#define JOS_KERN_CPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
+#include <inc/env.h>
+
+// Maximum number of CPUs
+#define NCPU	8
+
+// Values of cpu_status in struct CpuInfo
+enum {
+	CPU_UNUSED = 0,
+	CPU_STARTED,
+	CPU_HALTED,
+};
+
+// Per-CPU state
+struct CpuInfo {
+	uint8_t cpu_id;			// Local APIC ID
+	volatile unsigned cpu_status;	// The status of the CPU
+	struct Env *cpu_env;		// The currently-running environment
+	volatile bool cpu_inkernel;	// In the kernel, or trying to get in
+	volatile bool cpu_tlbflush;	// TLB shootdown pending (kern/pmap.c)
+	struct Taskstate cpu_ts;	// Used by x86 to find stack for interrupt
+};
+
+// Initialized in mpconfig.c
+extern struct CpuInfo cpus[NCPU];
+extern int ncpu;			// Total number of CPUs in the system
+extern struct CpuInfo *bootcpu;		// The boot-strap processor (BSP)
+extern physaddr_t lapicaddr;		// Physical MMIO address of the local APIC
+extern physaddr_t ioapicaddr;		// Physical MMIO address of the I/O APIC
+extern uint8_t apicid_cpu[256];		// Index into cpus[] of each APIC ID
+
+// Per-CPU kernel stacks
+extern unsigned char percpu_kstacks[NCPU][KSTKSIZE];
+
+int cpunum(void);
+#define thiscpu (&cpus[cpunum()])
+
+// Top of CPU i's kernel stack, as mapped below KSTACKTOP
+#define KSTACKTOP_CPU(i)	(KSTACKTOP - (i) * (KSTKSIZE + KSTKGAP))
+
+void mp_init(void);
+void lapic_init(void);
+void lapic_startap(uint8_t apicid, uint32_t addr);
+void lapic_eoi(void);
+void lapic_ipi(int apicid, int vector);
+void ioapic_init(void);
+
+#endif	// !JOS_KERN_CPU_H
@@ -1,8 +1,14 @@
 #include <inc/x86.h>
+#include <inc/stdio.h>
 #include <inc/string.h>
+#include <inc/error.h>
+#include <inc/assert.h>
 
 #include <kern/e100.h>
 #include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/picirq.h>
+#include <kern/cmdline.h>
 
 struct nic e100; // E100 network interface card data
 
@@ -18,6 +24,10 @@ e100_pci_attach(struct pci_func *pcif)
 	e100.irq_line = pcif->irq_line;
 
 	e100_init();
+
+	// Let frame received interrupts through the 8259A so that
+	// trap_dispatch can wake environments waiting for packets.
+	irq_setmask_8259A(irq_mask_8259A & ~(1 << e100.irq_line));
 	return 0;
 }
 
@@ -27,6 +37,12 @@ e100_init(void)
 	// Reset the device preparing it for normal operation.
 	e100_software_reset();
 
+	// Size the DMA rings. Bigger rings absorb longer bursts
+	// before frames are dropped, at the cost of memory.
+	e100.cbl_size = MAX(cmdline_int("e100.cbl", CBLSIZE), 2);
+	e100.rfa_size = MAX(cmdline_int("e100.rfa", RFASIZE), 2);
+	e100.rx_flip = cmdline_int("e100.rxflip", 1);
+
 	// Create the receive and transmit DMA rings.
 	e100_cbl_alloc();
 	e100_rfa_alloc();
@@ -44,6 +60,78 @@ e100_init(void)
 	// For the RU start (RU_START) command, the CPU activates the RU 
 	// for frame reception.
 	e100_exec_cmd(CSR_SCB_COMMAND, RUC_START);	
+
+	// Only interrupt us when the RU receives a frame (FR) or leaves 
+	// the ready state (RNR). Transmit completion is polled unless 
+	// someone is waiting for it, see e100_tx_sleep.
+	outb(e100.io_base + CSR_SCB_INTMASK, INTMASK_RX);
+}
+
+//
+// Wake every environment blocked in e100_tx_sleep and stop taking CU 
+// interrupts, since nobody is waiting for them any more.
+//
+static void
+e100_tx_wakeup(void)
+{
+	int i;
+	struct Env *e;
+
+	for (i = 0; i < E100_TXWAITERS; i++) {
+		if (!e100.tx_waiters[i])
+			continue;
+		if (envid2env(e100.tx_waiters[i], &e, 0) == 0 && 
+				e->env_status == ENV_NOT_RUNNABLE)
+			env_set_status(e, ENV_RUNNABLE);
+		e100.tx_waiters[i] = 0;
+	}
+	outb(e100.io_base + CSR_SCB_INTMASK, INTMASK_RX);
+}
+
+//
+// Handle an interrupt raised by the E100.
+//
+// Acknowledge every pending interrupt cause and, if the RU has received 
+// a frame or run out of resources, wake the environment (if any) blocked 
+// in sys_rx_wait so it can drain the RFA. If the CU has sent a frame or 
+// gone idle, reclaim the sent CBs and wake the environments blocked on 
+// a full CBL.
+//
+void
+e100_intr(void)
+{
+	int r;
+	uint8_t stat;
+	struct Env *e;
+
+	stat = inb(e100.io_base + CSR_SCB_STATACK);
+	outb(e100.io_base + CSR_SCB_STATACK, stat);
+
+	// Frames arriving while the RU has no resources are discarded.
+	if (stat & STAT_RNR)
+		++e100.rx_rnr;
+
+	// An environment that attached a ring gets frames pushed to it.
+	if ((stat & (STAT_FR|STAT_RNR)) && e100.rx_ring_env)
+		e100_rx_ring_fill();
+
+	if ((stat & (STAT_FR|STAT_RNR)) && e100.rx_waiter) {
+		// The waiter may have been destroyed while it was asleep.
+		r = envid2env(e100.rx_waiter, &e, 0);
+		if (r == 0 && e->env_status == ENV_NOT_RUNNABLE)
+			env_set_status(e, ENV_RUNNABLE);
+		e100.rx_waiter = 0;
+	}
+
+	if (stat & (STAT_CX|STAT_CNA)) {
+		e100_tx_clean();
+		if (e100.cbs_avail > 0)
+			e100_tx_wakeup();
+	}
+
+	// The E100 is usually wired to the slave 8259A, 
+	// which does not run in automatic EOI mode.
+	irq_eoi();
 }
 
 void 
@@ -80,19 +168,78 @@ void udelay(int loops)
 void
 e100_tx_clean(void)
 {
+	int i;
+	struct cb *cb;
+
 	// Clean CBs marked complete. The C bit indicates that the 
 	// transmit DMA has completed processing the last byte of 
 	// data associated with the TCB.	
-	while ((e100.cbs_avail <= CBLSIZE) && 
+	while ((e100.cbs_avail <= e100.cbl_size) && 
 			((e100.cb_to_clean->status & CB_COMPLETE))) {
-		e100.cb_to_clean = e100.cb_to_clean->next;
+		cb = e100.cb_to_clean;
+
+		// The CU is done with the fragments of a flexible mode 
+		// frame, so drop the references that kept them alive.
+		for (i = 0; i < cb->npages; i++)
+			page_decref(cb->pages[i]);
+		cb->npages = 0;
+
+		// CBs complete in ring order, so every frame queued 
+		// before this one has been sent as well.
+		if ((cb->command & CB_TX) && (int32_t) (cb->seq + 1 - e100.tx_done) > 0)
+			e100.tx_done = cb->seq + 1;
+
+		e100.cb_to_clean = cb->next;
 		++e100.cbs_avail;
 	}
 }
 
+//
+// Put environment e to sleep until the CU frees a CB. The caller backs 
+// up e's eip and yields, so e retries its transmit when it wakes up.
+// If too many environments are already waiting e is not put to sleep, 
+// and simply retries the next time it is scheduled.
+//
+// RETURNS
+// 	0 if e has been put to sleep, or a CB has been freed in the meantime
+// 	-E_NO_MEM if there is no room to record another waiter
+//
+int
+e100_tx_sleep(struct Env *e)
+{
+	int i;
+	struct Env *w;
+
+	for (i = 0; i < E100_TXWAITERS; i++)
+		if (!e100.tx_waiters[i] || e100.tx_waiters[i] == e->env_id ||
+				envid2env(e100.tx_waiters[i], &w, 0) < 0)
+			break;
+	if (i == E100_TXWAITERS)
+		return -E_NO_MEM;
+
+	// Ask for an interrupt as soon as the oldest pending frame 
+	// has been sent, and enable CU interrupts. If the CU got past
+	// that frame before seeing the I bit, it still raises CNA
+	// when it suspends at the end of the CBL.
+	e100.cb_to_clean->command |= CB_I;
+	outb(e100.io_base + CSR_SCB_INTMASK, INTMASK_TXWAIT);
+
+	// CBs that completed before the interrupts were enabled 
+	// won't interrupt us, so look for them now.
+	e100_tx_clean();
+	if (e100.cbs_avail > 0)
+		return 0;
+
+	e100.tx_waiters[i] = e->env_id;
+	env_set_status(e, ENV_NOT_RUNNABLE);
+	return 0;
+}
+
 int
 e100_xmit_prepare(const char *data, uint16_t len, uint16_t flag)
 {	
+	assert(len <= ETH_FRAME_LEN);
+
 	// 
 	// Place the packet into the next available buffer in the ring
 	// and prepare it to be sent to the CU for transport.
@@ -107,11 +254,60 @@ e100_xmit_prepare(const char *data, uint16_t len, uint16_t flag)
 	e100.cb_to_use->u.tcb.tcb_byte_count = len;
 	e100.cb_to_use->u.tcb.threshold = 0xe0;
 	e100.cb_to_use->u.tcb.tbd_count = 0;
+	e100.cb_to_use->seq = e100.tx_seq++;
 	memmove(e100.cb_to_use->u.tcb.data, data, len);
 
 	return 0;
 }
 
+// 
+// Transmits a frame in flexible mode. The CU gathers the frame from the 'n' 
+// fragments described by 'tbds', so nothing is copied. The TBD array itself 
+// lives in the data area of the TCB. The CB takes over the references on 
+// 'pages' (one per TBD) and drops them in e100_tx_clean once the frame has 
+// been sent. The frame's sequence number is stored in *seq_store.
+//
+// RETURNS
+// 	0 on success
+// 	-E_CBL_FULL if no more empty slots in cbl
+//
+int
+e100_xmit_sg(const struct tbd *tbds, struct Page **pages, int n, 
+		uint32_t *seq_store)
+{
+	int i, scb_status;
+	struct cb *cb;
+
+	e100_tx_clean();
+	if (e100.cbs_avail == 0) {
+		++e100.tx_drops;
+		return -E_CBL_FULL;
+	}
+
+	e100.cb_to_use->command &= ~CB_S;
+	e100.cb_to_use = e100.cb_to_use->next;
+	--e100.cbs_avail;
+
+	cb = e100.cb_to_use;
+	cb->status = 0;
+	cb->command = CB_TX | CB_TX_SF | CB_S;
+	cb->u.tcb.tbd_array = cb->pa + offsetof(struct cb, u.tcb.data);
+	cb->u.tcb.tcb_byte_count = 0;
+	cb->u.tcb.threshold = 0xe0;
+	cb->u.tcb.tbd_count = n;
+	memmove(cb->u.tcb.data, tbds, n * sizeof(struct tbd));
+	for (i = 0; i < n; i++)
+		cb->pages[i] = pages[i];
+	cb->npages = n;
+	*seq_store = cb->seq = e100.tx_seq++;
+
+	scb_status = inb(e100.io_base + CSR_SCB_STATUS);
+	if ((scb_status & CUS_MASK) == CUS_SUSPENDED)
+		e100_exec_cmd(CSR_SCB_COMMAND, CUC_RESUME);
+
+	return 0;
+}
+
 //
 // Transmits a packet of data in simple mode. The simplified structure expects 
 // the transmit data to reside entirely in the memory space immediately after 
@@ -133,8 +329,10 @@ e100_xmit_frame(const char *data, uint16_t len)
 
 	// If there are no more empty slots in the 
 	// transmit DMA ring drop the packet.
-	if (e100.cbs_avail == 0)
+	if (e100.cbs_avail == 0) {
+		++e100.tx_drops;
 		return -E_CBL_FULL;
+	}
 
 	// Places the packet into the next available buffer in the ring.
 	// Clear the S bit on the current CB so the CU proceeds to execute 
@@ -153,6 +351,28 @@ e100_xmit_frame(const char *data, uint16_t len)
 	return 0;
 }
 
+//
+// Allocate 'n' descriptors of 'size' bytes packed back to back in physically 
+// contiguous, zeroed pages, so a descriptor may straddle a page boundary 
+// without the device noticing. Descriptors are allocated once at attach 
+// time and never freed.
+//
+static void *
+e100_dma_alloc(int n, size_t size)
+{
+	int i, r, npages;
+	struct Page *pp;
+
+	npages = ROUNDUP(n * size, PGSIZE) / PGSIZE;
+	if ((r = page_alloc_npages(&pp, npages)) < 0)
+		panic("e100_dma_alloc: %e\n", r);
+	for (i = 0; i < npages; i++)
+		++pp[i].pp_ref;
+	memset(page2kva(pp), 0, npages * PGSIZE);
+
+	return page2kva(pp);
+}
+
 //
 // Allocate the command block list.
 //
@@ -165,21 +385,15 @@ e100_xmit_frame(const char *data, uint16_t len)
 void
 e100_cbl_alloc(void) 
 {
-	int i, r;
-	struct Page *pp;
-	struct cb *cb = NULL, *tail = NULL;
+	int i;
+	struct cb *cbs, *cb = NULL, *tail = NULL;
 
-	for (i = 0; i < CBLSIZE; i++) {
-		// Allocate a page for each command block.
-		// Must zero out the contents of the page and
-		// increment the reference count for it.
-		if ((r = page_alloc(&pp)) < 0) 
-			panic("e100_cbl_alloc: %e\n", r);		
-		memset(page2kva(pp), 0, PGSIZE);
-		++pp->pp_ref;
+	// Pack the command blocks into as few pages as possible.
+	cbs = e100_dma_alloc(e100.cbl_size, sizeof(struct cb));
 
-		cb = page2kva(pp);
-		cb->pa = page2pa(pp);
+	for (i = 0; i < e100.cbl_size; i++) {
+		cb = &cbs[i];
+		cb->pa = PADDR(cb);
 
 		if (i == 0) {
 			e100.cbs = cb;
@@ -198,7 +412,7 @@ e100_cbl_alloc(void)
 	tail->next = e100.cbs;
 	e100.cbs->prev = tail;
 
-	e100.cbs_avail = CBLSIZE;	
+	e100.cbs_avail = e100.cbl_size;
 	e100.cb_to_clean = e100.cbs;
 	e100.cb_to_use = tail;
 
@@ -216,7 +430,7 @@ e100_rx_clean(void)
 {
 	// Clean RFDs marked complete. This bit indicates the completion 
 	// of frame reception. It is set by the device.	
-	while ((e100.rfds_avail <= RFASIZE) && 
+	while ((e100.rfds_avail <= e100.rfa_size) && 
 			(e100.rfd_to_clean->next->status & RFD_COMPLETE)) {
 		e100.rfd_to_clean = e100.rfd_to_clean->next;
 		e100.rfds_avail++;
@@ -265,7 +479,7 @@ e100_rx(char *data)
 	// If there are no packets in the receive DMA ring signal
 	// to the asking the user environment to go to sleep and
 	// try to re-execute the system call at a later time.
-	if (e100.rfds_avail == RFASIZE)
+	if (e100.rfds_avail == e100.rfa_size)
 		return -E_RFA_EMPTY;
 
 	// Indicate newly arrived packets.
@@ -282,6 +496,216 @@ e100_rx(char *data)
 	return r;	
 }
 
+//
+// Drain up to 'max' received frames into 'buf', a buffer of 'size' bytes, 
+// as a packed array of struct jif_pkt records (see JIF_PKT_NEXT). The list 
+// is terminated with a zero length record if there is room left for one.
+// Frames that don't fit stay in the ring for the next call.
+//
+// RETURNS
+// 	the number of frames copied into buf
+// 	-E_RFA_EMPTY if there are no packets in the receive DMA ring
+//
+int
+e100_rx_batch(char *buf, size_t size, int max)
+{
+	int n, scb_status;
+	size_t len, off = 0;
+	struct jif_pkt *pkt;
+
+	for (n = 0; n < max; n++) {
+		e100_rx_clean();
+		if (e100.rfds_avail <= e100.rfa_size)
+			break;
+
+		// Make sure the whole record fits before indicating it.
+		len = e100.rfd_to_use->actual_size & RFD_AC_MASK;
+		if (off + sizeof(struct jif_pkt) + len > size)
+			break;
+
+		pkt = (struct jif_pkt *) (buf + off);
+		pkt->jp_len = e100_rx_indicate(pkt->jp_data);
+		off += (char *) JIF_PKT_NEXT(pkt) - (char *) pkt;
+	}
+
+	if (n == 0)
+		return -E_RFA_EMPTY;
+
+	if (off + sizeof(struct jif_pkt) <= size)
+		((struct jif_pkt *) (buf + off))->jp_len = 0;
+
+	scb_status = inb(e100.io_base + CSR_SCB_STATUS);	
+	if ((scb_status & RUS_MASK) == RUS_SUSPENDED)
+		e100_exec_cmd(CSR_SCB_COMMAND, RUC_RESUME);
+
+	return n;
+}
+
+//
+// Hand the page of the next received frame to the caller instead of copying
+// the frame out of it, and swap a fresh page into the RFA in its place.
+//
+// The detached page is laid out as a struct jif_pkt at JIF_RFD_PKTOFF whose 
+// jp_data is the frame data the E100 wrote. Everything else in the page, 
+// including the RFD header and the driver's bookkeeping, is cleared so no 
+// kernel state leaks to the environment the page is mapped into. 
+// The caller owns the reference returned in *pp_store.
+//
+// RETURNS
+// 	the length of the frame on success
+// 	-E_RFA_EMPTY if there are no packets in the receive DMA ring
+// 	-E_NO_MEM if there is no page to swap into the ring
+// 	-E_NOT_SUPP if the RFDs are packed (the e100.rxflip boot parameter is 0)
+//
+int
+e100_rx_flip(struct Page **pp_store)
+{
+	int r, len, scb_status;
+	struct Page *pp;
+	struct rfd *old, *rfd;
+	struct jif_pkt *pkt;
+
+	if (!e100.rx_flip)
+		return -E_NOT_SUPP;
+
+	e100_rx_clean();
+	if (e100.rfds_avail <= e100.rfa_size)
+		return -E_RFA_EMPTY;
+
+	if ((r = page_alloc(&pp)) < 0)
+		return r;
+	++pp->pp_ref;
+
+	// Initialize the replacement RFD as the new end of the RFA, 
+	// which is where e100_rx_indicate would have put the old one.
+	old = e100.rfd_to_use;
+	rfd = page2kva(pp);
+	memset(rfd, 0, offsetof(struct rfd, data));
+	rfd->command = RFD_S;
+	rfd->size = ETH_FRAME_LEN;
+	rfd->pa = page2pa(pp);
+
+	// Splice it into the ring in place of the old RFD.
+	rfd->link = old->link;
+	rfd->next = old->next;
+	rfd->prev = old->prev;
+	old->prev->link = rfd->pa;
+	old->prev->next = rfd;
+	old->next->prev = rfd;
+	old->prev->command &= ~RFD_S;
+	if (e100.rfds == old)
+		e100.rfds = rfd;
+	if (e100.rfd_to_clean == old)
+		e100.rfd_to_clean = rfd;
+
+	--e100.rfds_avail;
+	e100.rfd_to_use = rfd->next;
+
+	scb_status = inb(e100.io_base + CSR_SCB_STATUS);	
+	if ((scb_status & RUS_MASK) == RUS_SUSPENDED)
+		e100_exec_cmd(CSR_SCB_COMMAND, RUC_RESUME);
+
+	// Turn the old RFD into a struct jif_pkt record.
+	len = old->actual_size & RFD_AC_MASK;
+	pkt = (struct jif_pkt *) ((char *) old + JIF_RFD_PKTOFF);
+	memset(old, 0, JIF_RFD_PKTOFF);
+	pkt->jp_len = len;
+	memset(pkt->jp_data + len, 0, PGSIZE - offsetof(struct rfd, data) - len);
+
+	// Give the ring's reference to the caller.
+	*pp_store = pa2page(PADDR(old));
+	return len;
+}
+
+//
+// Put environment e to sleep until the next frame arrives.
+// Only a single environment (the network input helper) can be 
+// waiting at any one time; a newer waiter replaces an older one.
+//
+void
+e100_rx_sleep(struct Env *e)
+{
+	e100.rx_waiter = e->env_id;
+	env_set_status(e, ENV_NOT_RUNNABLE);
+}
+
+//
+// Make e the consumer of the jif_ring held in 'pages', replacing any 
+// previous one. From now on received frames are copied into the ring 
+// as they arrive by e100_rx_ring_fill. The ring keeps a reference on 
+// each of its pages, so they outlive the environment if need be.
+//
+void
+e100_rx_ring_attach(struct Env *e, struct Page **pages)
+{
+	int i;
+
+	// Slots must not straddle pages, see e100_rx_ring_fill.
+	static_assert(offsetof(struct jif_ring, jr_slots) == PGSIZE);
+	static_assert(PGSIZE % JIF_RING_SLOTSIZE == 0);
+	static_assert(sizeof(struct jif_pkt) + ETH_FRAME_LEN <= JIF_RING_SLOTSIZE);
+
+	for (i = 0; i < JIF_RING_PAGES; i++) {
+		++pages[i]->pp_ref;
+		if (e100.rx_ring_env)
+			page_decref(e100.rx_ring_pages[i]);
+		e100.rx_ring_pages[i] = pages[i];
+	}
+	e100.rx_ring_env = e->env_id;
+}
+
+//
+// Move the frames the RU has received from the RFA into the attached 
+// jif_ring, and wake its consumer if it went to sleep on an empty ring.
+// Frames that don't fit stay in the RFA until the consumer makes room
+// and asks for more by calling sys_ring_wait.
+//
+void
+e100_rx_ring_fill(void)
+{
+	int i, n, scb_status;
+	struct Env *e;
+	struct jif_ring *r;
+	struct jif_pkt *pkt;
+	uint32_t off;
+
+	if (!e100.rx_ring_env)
+		return;
+
+	// Drop the ring once its consumer is gone.
+	if (envid2env(e100.rx_ring_env, &e, 0) < 0) {
+		for (i = 0; i < JIF_RING_PAGES; i++)
+			page_decref(e100.rx_ring_pages[i]);
+		e100.rx_ring_env = 0;
+		return;
+	}
+
+	// The ring is only mapped in the consumer's address space, so 
+	// access it through the kernel's mapping of its pages.
+	r = page2kva(e100.rx_ring_pages[0]);
+	for (n = 0; r->jr_head - r->jr_tail < JIF_RING_NSLOTS; n++) {
+		e100_rx_clean();
+		if (e100.rfds_avail <= e100.rfa_size)
+			break;
+
+		off = offsetof(struct jif_ring, jr_slots) + 
+			(r->jr_head % JIF_RING_NSLOTS) * JIF_RING_SLOTSIZE;
+		pkt = (struct jif_pkt *) ((char *) page2kva(
+			e100.rx_ring_pages[off / PGSIZE]) + off % PGSIZE);
+		pkt->jp_len = e100_rx_indicate(pkt->jp_data);
+		if (jif_ring_push(r) && e->env_ring_waiting) {
+			e->env_ring_waiting = 0;
+			env_set_status(e, ENV_RUNNABLE);
+		}
+	}
+
+	if (n > 0) {
+		scb_status = inb(e100.io_base + CSR_SCB_STATUS);	
+		if ((scb_status & RUS_MASK) == RUS_SUSPENDED)
+			e100_exec_cmd(CSR_SCB_COMMAND, RUC_RESUME);
+	}
+}
+
 //
 // Allocate the receive frame area.
 //
@@ -291,25 +715,39 @@ e100_rx(char *data)
 // have access to the CPU's MMU to translate virtual addresses into physical 
 // addresses.
 //
+// RFDs that may be flipped to user environments by e100_rx_flip need a page 
+// each; otherwise they are packed like the CBL.
+//
 void
 e100_rfa_alloc(void) 
 {
 	int i, r;
 	struct Page *pp;
-	struct rfd *rfd = NULL, *tail = NULL;
-
-	for (i = 0; i < RFASIZE; i++) {
-		// Allocate a page for each command block.
-		// Must zero out the contents of the page and
-		// increment the reference count for it.
-		if ((r = page_alloc(&pp)) != 0)
-			panic("e100_rfa_alloc: %e\n", r);
-		memset(page2kva(pp), 0, PGSIZE);
-		++pp->pp_ref;
+	struct rfd *rfds = NULL, *rfd = NULL, *tail = NULL;
+
+	// e100_rx_flip relies on the frame data of an RFD lining up 
+	// with the jp_data of a struct jif_pkt at JIF_RFD_PKTOFF.
+	static_assert(offsetof(struct rfd, data) == 
+			JIF_RFD_PKTOFF + sizeof(struct jif_pkt));
+
+	if (!e100.rx_flip)
+		rfds = e100_dma_alloc(e100.rfa_size, sizeof(struct rfd));
+
+	for (i = 0; i < e100.rfa_size; i++) {
+		if (e100.rx_flip) {
+			// Allocate a page for each RFD.
+			// Must zero out the contents of the page and
+			// increment the reference count for it.
+			if ((r = page_alloc(&pp)) != 0)
+				panic("e100_rfa_alloc: %e\n", r);
+			memset(page2kva(pp), 0, PGSIZE);
+			++pp->pp_ref;
+			rfd = page2kva(pp);
+		} else
+			rfd = &rfds[i];
 
 		// Initialize the RFD
-		rfd = page2kva(pp);
-		rfd->pa = page2pa(pp);
+		rfd->pa = PADDR(rfd);
 		rfd->size = ETH_FRAME_LEN;
 
 		if (i == 0) {
@@ -329,8 +767,28 @@ e100_rfa_alloc(void)
 	tail->next = e100.rfds;
 	e100.rfds->prev = tail;
 
-	e100.rfds_avail = RFASIZE;
+	e100.rfds_avail = e100.rfa_size;
 	e100.rfd_to_clean = tail;
 	e100.rfd_to_use = e100.rfds;
 }
 
+//
+// Print the ring sizes, the number of descriptors in use and the drop 
+// counters, to help size the rings for the expected bursts.
+//
+void
+e100_stats(void)
+{
+	if (!e100.io_base) {
+		cprintf("e100: no device\n");
+		return;
+	}
+
+	cprintf("e100: CBL %d CBs, %d in use, %u frames sent, %u dropped\n", 
+		e100.cbl_size, e100.cbl_size - 1 - e100.cbs_avail, 
+		e100.tx_done, e100.tx_drops);
+	cprintf("e100: RFA %d RFDs (%s), RU ran out of RFDs %u times\n", 
+		e100.rfa_size, e100.rx_flip ? "page each" : "packed", 
+		e100.rx_rnr);
+}
+
@@ -1,6 +1,7 @@
 #ifndef JOS_KERN_E100_H
 #define JOS_KERN_E100_H
 
+#include <inc/env.h>
 #include <inc/ns.h>
 #include <kern/pci.h>
 
@@ -21,7 +22,9 @@
 
 // CSR (Control/Status Registers)
 #define CSR_SCB_STATUS 	0x00
+#define CSR_SCB_STATACK 0x01
 #define CSR_SCB_COMMAND 0x02
+#define CSR_SCB_INTMASK 0x03
 #define CSR_SCB_GEN_PTR 0x04
 #define CSR_PORT 				0x08
 #define CSR_EEPROM 			0x0e
@@ -37,7 +40,32 @@
 #define RUS_SUSPENDED 	0x04
 #define RUS_NO_RES		 	0x08
 #define RUS_READY			 	0x10
-#define RUS_MASK 				0xc0
+#define RUS_MASK 				0x3c
+
+// SCB STAT/ACK bits. Reading them reports the pending interrupts, 
+// writing them back acknowledges the interrupts.
+#define STAT_CX 		0x80
+#define STAT_FR 		0x40
+#define STAT_CNA 		0x20
+#define STAT_RNR 		0x10
+#define STAT_MDI 		0x08
+#define STAT_SWI 		0x04
+#define STAT_FCP 		0x01
+
+// SCB interrupt mask bits. A set bit masks the interrupt.
+#define INT_CX 			0x80
+#define INT_FR 			0x40
+#define INT_CNA 		0x20
+#define INT_RNR 		0x10
+#define INT_ER 			0x08
+#define INT_FCP 		0x04
+#define INT_SI 			0x02
+#define INT_M 			0x01
+
+// Normally only receive events interrupt us. While an environment is 
+// blocked waiting for a free CB, CU events interrupt us as well.
+#define INTMASK_RX			(INT_CX|INT_CNA|INT_ER|INT_FCP)
+#define INTMASK_TXWAIT	(INT_ER|INT_FCP)
 
 // SCB commands
 #define CUC_NOP 				0x00
@@ -110,9 +138,20 @@
 // move blocks of data manually to and from the device and wasting CPU cycles.
 //
 
-#define CBLSIZE 10
-#define RFASIZE CBLSIZE
+// Default ring sizes, overridden by the e100.cbl and e100.rfa boot parameters.
+#define CBLSIZE 32
+#define RFASIZE 64
 #define ETH_FRAME_LEN 1518
+#define E100_MAXTBDS 16
+#define E100_TXWAITERS 4
+
+// In flexible mode the CU gathers a frame from an array of Transmit Buffer 
+// Descriptors (TBD), each pointing at one physically contiguous fragment.
+struct tbd {
+	physaddr_t addr; // physical address of the fragment
+	uint16_t size; // the number of bytes in the fragment
+	uint16_t eol; // reserved
+};
 
 // A control DMA ring is composed of buffers called Command Blocks (CB).
 // The DMA ring of CBs is called a Command Block List (CBL).
@@ -131,6 +170,9 @@ struct cb {
 	} u;
 	struct cb *next, *prev; // pointers to next and prev in cbl
 	physaddr_t pa; // physical address of the cb
+	uint32_t seq; // sequence number of the frame in the cb
+	int npages; // number of pages referenced by the TBD array
+	struct Page *pages[E100_MAXTBDS]; // pages held until the frame is sent
 };
 
 // Buffers in the receive DMA ring are called Receive Frame Descriptors (RFD).
@@ -156,33 +198,57 @@ struct nic {
 	uint8_t irq_line; // line to listen to receive interrupts from the device
 
 	// CBL
+	int cbl_size; // number of CBs in the ring
 	int cbs_avail; // keeps track of number of free CB resources available
 	struct cb *cbs; // the first cb in the ring
 	struct cb *cb_to_clean; // the next CB to check for completion
 	struct cb *cb_to_use; // the next CB to use for queuing a command
+	uint32_t tx_seq; // sequence number of the next frame to queue
+	uint32_t tx_done; // number of frames sent by the CU
+	uint32_t tx_drops; // frames dropped because the CBL was full
+	envid_t tx_waiters[E100_TXWAITERS]; // environments blocked on a full CBL
 
 	// RFA
+	int rfa_size; // number of RFDs in the ring
+	int rx_flip; // RFDs get a page each so they can be flipped to users
 	int rfds_avail; // keeps track of number of free RFD resources available
 	struct rfd *rfds; // the first RFD in the ring
 	struct rfd *rfd_to_clean; // the next RFD to check for completion
 	struct rfd *rfd_to_use; // the next RFD to use for queuing a command
+	envid_t rx_waiter; // environment blocked waiting for a frame
+	uint32_t rx_rnr; // times the RU ran out of RFDs and discarded frames
+	envid_t rx_ring_env; // environment the RFA is drained into, if any
+	struct Page *rx_ring_pages[JIF_RING_PAGES]; // pages of its jif_ring
 };
 
+extern struct nic e100;
+
 int e100_pci_attach(struct pci_func *pcif);
 void e100_init(void);
 void e100_software_reset(void);
 void udelay(int loops);
 void e100_exec_cmd(uint8_t csr, uint8_t cmd);
+void e100_intr(void);
 
 void e100_cbl_alloc(void);
 int e100_xmit_frame(const char *data, uint16_t len);
 int e100_xmit_prepare(const char *data, uint16_t len, uint16_t flag);
+int e100_xmit_sg(const struct tbd *tbds, struct Page **pages, int n, 
+		uint32_t *seq_store);
 void e100_tx_clean(void);
+int e100_tx_sleep(struct Env *e);
 
 void e100_rfa_alloc(void);
 int e100_rx(char *data);
+int e100_rx_batch(char *buf, size_t size, int max);
+int e100_rx_flip(struct Page **pp_store);
 int e100_rx_indicate(char* data);
 void e100_rx_clean(void);
+void e100_rx_sleep(struct Env *e);
+void e100_rx_ring_attach(struct Env *e, struct Page **pages);
+void e100_rx_ring_fill(void);
+
+void e100_stats(void);
 
 #endif	// JOS_KERN_E100_H
 
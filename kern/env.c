@@ -12,9 +12,10 @@
 #include <kern/trap.h>
 #include <kern/monitor.h>
 #include <kern/sched.h>
+#include <kern/time.h>
+#include <kern/spinlock.h>
 
 struct Env *envs = NULL;		// All environments
-struct Env *curenv = NULL;		// The current env
 static struct Env_list env_free_list;	// Free list
 
 #define ENVGENSHIFT	12		// >= LOGNENV
@@ -75,6 +76,7 @@ void
 env_init(void)
 {
 	int i;
+	sched_init();
 	for (i = NENV-1; i >= 0; --i) {
 		envs[i].env_status = ENV_FREE;
 		envs[i].env_id = 0;
@@ -175,7 +177,14 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	
 	// Set the basic status variables.
 	e->env_parent_id = parent_id;
-	e->env_status = ENV_RUNNABLE;
+	e->env_prio = e->env_level = ENV_PRIO_DEFAULT;
+	e->env_server = 0;
+	e->env_ticks = 0;
+	e->env_preempted = 0;
+	e->env_cpunum = cpunum();
+	memset(&e->env_stat, 0, sizeof(e->env_stat));
+	e->env_stat_tsc = read_tsc();
+	env_set_status(e, ENV_RUNNABLE);
 	e->env_runs = 0;
 
 	// Clear out all the saved register state,
@@ -204,8 +213,12 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
 
-	// Also clear the IPC receiving flag.
+	// Also clear the IPC receiving flag and message queue.
 	e->env_ipc_recving = 0;
+	e->env_ipc_waitfrom = 0;
+	e->env_ipc_qhead = 0;
+	e->env_ipc_qcount = 0;
+	e->env_ring_waiting = 0;
 
 	// If this is the file server (e == &envs[1]) give it I/O privileges.
 	// The IOPL (I/O Privilege level) flag shows the I/O privilege level 
@@ -371,8 +384,9 @@ load_icode(struct Env *e, uint8_t *binary, size_t size)
 // This function is ONLY called during kernel initialization,
 // before running the first user-mode environment.
 // The new env's parent ID is set to 0.
+// Returns the new env.
 //
-void
+struct Env *
 env_create(uint8_t *binary, size_t size)
 {
 	int r;
@@ -383,6 +397,35 @@ env_create(uint8_t *binary, size_t size)
 		panic("env_create: %e\n", r);
 
 	load_icode(e, binary, size);
+	return e;
+}
+
+//
+// Return the pages of queued IPC message 'msg', msg->im_npages of them.
+//
+struct Page **
+env_ipc_msg_pages(struct Ipcmsg *msg)
+{
+	if (msg->im_npages > 1)
+		return page2kva(msg->im_page);
+	return &msg->im_page;
+}
+
+//
+// Drop the references queued IPC message 'msg' holds on its pages.
+//
+void
+env_ipc_msg_drop(struct Ipcmsg *msg)
+{
+	struct Page **pp = env_ipc_msg_pages(msg);
+	unsigned i;
+
+	for (i = 0; i < msg->im_npages; i++)
+		page_decref(pp[i]);
+	if (msg->im_npages > 1)
+		page_decref(msg->im_page);
+	msg->im_page = NULL;
+	msg->im_npages = 0;
 }
 
 //
@@ -404,6 +447,12 @@ env_free(struct Env *e)
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
+	// Drop the pages of IPC messages that were never received
+	for (; e->env_ipc_qcount > 0; e->env_ipc_qcount--) {
+		env_ipc_msg_drop(&e->env_ipc_queue[e->env_ipc_qhead]);
+		e->env_ipc_qhead = (e->env_ipc_qhead + 1) % IPCQSIZE;
+	}
+
 	// Flush all mapped pages in the user portion of the address space
 	static_assert(UTOP % PTSIZE == 0);
 	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
@@ -412,6 +461,12 @@ env_free(struct Env *e)
 		if (!(e->env_pgdir[pdeno] & PTE_P))
 			continue;
 
+		// a superpage has no page table
+		if (e->env_pgdir[pdeno] & PTE_PS) {
+			page_remove_super(e->env_pgdir, PGADDR(pdeno, 0, 0));
+			continue;
+		}
+
 		// find the pa and va of the page table
 		pa = PTE_ADDR(e->env_pgdir[pdeno]);
 		pt = (pte_t*) KADDR(pa);
@@ -434,10 +489,57 @@ env_free(struct Env *e)
 	page_decref(pa2page(pa));
 
 	// return the environment to the free list
-	e->env_status = ENV_FREE;
+	env_set_status(e, ENV_FREE);
 	LIST_INSERT_HEAD(&env_free_list, e, env_link);
 }
 
+//
+// Change the status of environment e, keeping the scheduler's run queue
+// in step. Every change of env_status must go through here.
+//
+void
+env_set_status(struct Env *e, unsigned status)
+{
+	if (e->env_status == status)
+		return;
+	env_account(e);
+	if (e == curenv && status == ENV_NOT_RUNNABLE)
+		e->env_stat.es_vswitch++;
+	if (e->env_status == ENV_RUNNABLE)
+		sched_dequeue(e);
+	else if (e->env_status == ENV_NOT_RUNNABLE)
+		sched_unblock(e);
+	if (status != ENV_NOT_RUNNABLE)
+		// no longer blocked, so a pending timeout is moot
+		time_cancel(e);
+	e->env_status = status;
+	if (status == ENV_RUNNABLE)
+		sched_enqueue(e);
+	else if (status == ENV_NOT_RUNNABLE)
+		sched_block(e);
+}
+
+//
+// Charge the time since e's accounting was last updated to running,
+// waiting for a CPU or being blocked, whichever e has been doing all
+// that time. Must be called before e is switched to or from a CPU, or
+// changes status.
+//
+void
+env_account(struct Env *e)
+{
+	uint64_t now = read_tsc();
+	uint64_t cycles = now - e->env_stat_tsc;
+
+	e->env_stat_tsc = now;
+	if (sched_oncpu(e))
+		e->env_stat.es_run += cycles;
+	else if (e->env_status == ENV_RUNNABLE)
+		e->env_stat.es_wait += cycles;
+	else if (e->env_status == ENV_NOT_RUNNABLE)
+		e->env_stat.es_block += cycles;
+}
+
 //
 // Frees environment e.
 // If e was the current env, then runs a new environment (and does not return
@@ -446,6 +548,14 @@ env_free(struct Env *e)
 void
 env_destroy(struct Env *e) 
 {
+	// If e is currently running on another CPU, we can't free its
+	// address space under it, so make it a zombie, to be freed the
+	// next time it traps into the kernel.
+	if (e != curenv && sched_oncpu(e)) {
+		env_set_status(e, ENV_DYING);
+		return;
+	}
+
 	env_free(e);
 
 	if (curenv == e) {
@@ -488,14 +598,31 @@ env_run(struct Env *e)
 	//	   update its 'env_runs' counter, and
 	//	   and use lcr3() to switch to its address space.
 	if (curenv != e) {
+		if (curenv) {
+			// Count a preemption only if it actually cost
+			// curenv the CPU.
+			if (curenv->env_preempted)
+				curenv->env_stat.es_ivswitch++;
+			curenv->env_preempted = 0;
+			env_account(curenv);
+		}
+		env_account(e);
 		curenv = e;
 		++curenv->env_runs;
 		lcr3(curenv->env_cr3);
 	}	
 
+	e->env_preempted = 0;
+
+	// An environment runs off the run queue of the CPU it runs on.
+	if (e->env_cpunum != cpunum())
+		sched_migrate(e, cpunum());
+
 	// Step 2: Use env_pop_tf() to restore the environment's
 	//	   registers and drop into user mode in the
 	//	   environment.
+	thiscpu->cpu_inkernel = 0;
+	unlock_kernel();
 	env_pop_tf(&curenv->env_tf);
 }
 
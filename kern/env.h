@@ -4,6 +4,7 @@
 #define JOS_KERN_ENV_H
 
 #include <inc/env.h>
+#include <kern/cpu.h>
 
 #ifndef JOS_MULTIENV
 // Change this value to 1 once you're allowing multiple environments
@@ -12,15 +13,20 @@
 #endif
 
 extern struct Env *envs;		// All environments
-extern struct Env *curenv;		// Current environment
+#define curenv (thiscpu->cpu_env)		// Current environment
 
 LIST_HEAD(Env_list, Env);		// Declares 'struct Env_list'
+TAILQ_HEAD(Env_tailq, Env);		// Declares 'struct Env_tailq'
 
 void	env_init(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
-void	env_create(uint8_t *binary, size_t size);
+struct Env *env_create(uint8_t *binary, size_t size);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
+void	env_set_status(struct Env *e, unsigned status);
+void	env_account(struct Env *e);
+struct Page **env_ipc_msg_pages(struct Ipcmsg *msg);
+void	env_ipc_msg_drop(struct Ipcmsg *msg);
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
@@ -40,4 +46,12 @@ void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 		(int)_binary_obj_##x##_size);		\
 }
 
+// Create a server, such as fs, which is trusted with env_server.
+#define ENV_CREATE_SERVER(x)		{		\
+	extern uint8_t _binary_obj_##x##_start[],	\
+		_binary_obj_##x##_size[];		\
+	env_create(_binary_obj_##x##_start,		\
+		(int)_binary_obj_##x##_size)->env_server = 1; \
+}
+
 #endif // !JOS_KERN_ENV_H
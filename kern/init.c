@@ -3,6 +3,7 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
@@ -14,10 +15,15 @@
 #include <kern/picirq.h>
 #include <kern/time.h>
 #include <kern/pci.h>
+#include <kern/cmdline.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+static void boot_aps(void);
 
 
 void
-i386_init(void)
+i386_init(uint32_t mbmagic, physaddr_t mbinfo)
 {
 	extern char edata[], end[];
 
@@ -32,6 +38,9 @@ i386_init(void)
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	// Grab the boot parameters before the memory holding them is reused.
+	cmdline_init(mbmagic, mbinfo);
+
 	// Lab 2 memory management initialization functions
 	i386_detect_memory();
 	i386_vm_init();
@@ -40,22 +49,31 @@ i386_init(void)
 	env_init();
 	idt_init();
 
+	// Lab 4 multiprocessor initialization functions
+	mp_init();
+
 	// Lab 4 multitasking initialization functions
 	pic_init();
-	kclock_init();
-
-	time_init();
+	time_init();	// also starts the clock, see kclock_init
+	lapic_init();	// after time_init, to calibrate the APIC timer
+	ioapic_init();
 	pci_init();
 
+	// Acquire the big kernel lock before waking up APs
+	lock_kernel();
+
+	// Starting non-boot CPUs
+	boot_aps();
+
 	// Should always have an idle process as first one.
 	ENV_CREATE(user_idle);
 
 	// Start fs.
-	ENV_CREATE(fs_fs);
+	ENV_CREATE_SERVER(fs_fs);
 
 #if !defined(TEST_NO_NS)
 	// Start ns.
-	ENV_CREATE(net_ns);
+	ENV_CREATE_SERVER(net_ns);
 #endif
 
 #if defined(TEST)
@@ -76,6 +94,84 @@ i386_init(void)
 	sched_yield();
 }
 
+// While boot_aps is booting a given CPU, it communicates the per-core
+// stack pointer that should be loaded by mpentry.S to that CPU in
+// this variable.
+void *mpentry_kstack;
+
+// The %cr4 that mpentry.S loads before it turns on paging.
+uint32_t mpentry_cr4;
+
+// Start the non-boot (AP) processors.
+static void
+boot_aps(void)
+{
+	extern unsigned char mpentry_start[], mpentry_end[];
+	void *code;
+	struct CpuInfo *c;
+
+	// Write entry code to unused memory at MPENTRY_PADDR
+	code = KADDR(MPENTRY_PADDR);
+	memmove(code, mpentry_start, mpentry_end - mpentry_start);
+
+	// mpentry.S turns on paging while still running at its physical
+	// address, so map VA 0:4MB to PA 0:4MB meanwhile, just as 
+	// i386_vm_init did for the boot CPU.  This CPU has CR4_PGE on, so
+	// leave out PTE_G, lest the mapping outlive the lcr3 below.
+	boot_pgdir[0] = boot_pgdir[PDX(KERNBASE)] & ~PTE_G;
+
+	// The APs need CR4_PSE if KERNBASE is mapped with 4MB pages, but
+	// mustn't have CR4_PGE while the PTE_G mappings are at 0 too.
+	mpentry_cr4 = rcr4() & ~CR4_PGE;
+
+	// Boot each AP one at a time
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == cpus + cpunum())  // We've started already.
+			continue;
+
+		// Tell mpentry.S what stack to use 
+		mpentry_kstack = percpu_kstacks[c - cpus] + KSTKSIZE;
+		// Start the CPU at mpentry_start
+		lapic_startap(c->cpu_id, PADDR(code));
+		// Wait for the CPU to finish some basic setup in mp_main()
+		while(c->cpu_status != CPU_STARTED)
+			;
+	}
+
+	boot_pgdir[0] = 0;
+	lcr3(boot_cr3);
+}
+
+// Setup code for APs
+void
+mp_main(void)
+{
+	// We are in high EIP now, safe to switch to the kernel's own GDT
+	// and reload all segment registers, as i386_vm_init does.
+	asm volatile("lgdt gdt_pd");
+	asm volatile("movw %%ax,%%gs" :: "a" (GD_UD|3));
+	asm volatile("movw %%ax,%%fs" :: "a" (GD_UD|3));
+	asm volatile("movw %%ax,%%es" :: "a" (GD_KD));
+	asm volatile("movw %%ax,%%ds" :: "a" (GD_KD));
+	asm volatile("movw %%ax,%%ss" :: "a" (GD_KD));
+	asm volatile("ljmp %0,$1f\n 1:\n" :: "i" (GD_KT));  // reload cs
+	asm volatile("lldt %%ax" :: "a" (0));
+
+	cprintf("SMP: CPU %d starting\n", cpunum());
+
+	lapic_init();
+	idt_init_percpu();
+	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
+
+	// Now that we have finished some basic setup, take the big kernel
+	// lock and start running environments.  boot_aps has removed the
+	// low identity mapping by the time we get the lock, so global
+	// pages can be turned on.
+	lock_kernel();
+	tlb_global_init();
+	sched_yield();
+}
+
 
 /*
  * Variable panicstr contains argument to first call to panic; used as flag
@@ -0,0 +1,51 @@
+// The I/O APIC routes device interrupts to local APICs.
+// See the Intel 82093AA I/O APIC datasheet.
+
+#include <inc/types.h>
+#include <inc/stdio.h>
+#include <inc/trap.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/picirq.h>
+
+#define IOREGSEL	(0x00/4)	// Register select
+#define IOWIN		(0x10/4)	// Register data
+
+#define REG_VER		0x01		// Version, with the number of pins
+#define REG_TABLE	0x10		// Redirection table base
+	#define INT_DISABLED	0x00010000	// Interrupt masked
+
+static volatile uint32_t *ioapic;
+
+static uint32_t
+ioapic_read(int reg)
+{
+	ioapic[IOREGSEL] = reg;
+	return ioapic[IOWIN];
+}
+
+static void
+ioapic_write(int reg, uint32_t data)
+{
+	ioapic[IOREGSEL] = reg;
+	ioapic[IOWIN] = data;
+}
+
+// Device interrupts keep coming through the 8259A, which the boot CPU
+// gets on LINT0 in virtual wire mode (see lapic_init), so every I/O APIC
+// pin is masked to make sure nothing is delivered twice.
+void
+ioapic_init(void)
+{
+	int i, maxintr;
+
+	if (!ioapicaddr)
+		return;
+
+	ioapic = mmio_map_region(ioapicaddr, PGSIZE);
+	maxintr = (ioapic_read(REG_VER) >> 16) & 0xFF;
+	for (i = 0; i <= maxintr; i++) {
+		ioapic_write(REG_TABLE + 2*i, INT_DISABLED | (IRQ_OFFSET + i));
+		ioapic_write(REG_TABLE + 2*i + 1, 0);
+	}
+}
@@ -2,7 +2,8 @@
 
 /* Support for two time-related hardware gadgets: 1) the run time
  * clock with its NVRAM access functions; 2) the 8253 timer, which
- * generates interrupts on IRQ 0.
+ * generates interrupts on IRQ 0 and which we also use to measure the
+ * speed of the TSC.
  */
 
 #include <inc/x86.h>
@@ -30,14 +31,64 @@ mc146818_write(unsigned reg, unsigned datum)
 
 
 void
-kclock_init(void)
+kclock_init(int hz)
+{
+	/* initialize 8253 clock to interrupt hz times/sec */
+	kclock_periodic(hz);
+	cprintf("	Setup timer interrupts via 8259A at %d Hz\n", hz);
+	cprintf("	unmasked timer interrupt\n");
+}
+
+// Interrupt hz times a second.
+void
+kclock_periodic(int hz)
 {
-	/* initialize 8253 clock to interrupt 100 times/sec */
 	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-	outb(IO_TIMER1, TIMER_DIV(100) % 256);
-	outb(IO_TIMER1, TIMER_DIV(100) / 256);
-	cprintf("	Setup timer interrupts via 8259A\n");
+	outb(IO_TIMER1, TIMER_DIV(hz) % 256);
+	outb(IO_TIMER1, TIMER_DIV(hz) / 256);
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<0));
+}
+
+// Interrupt once, after 'count' 8253 clock cycles, then stay quiet.
+void
+kclock_oneshot(uint16_t count)
+{
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_INTTC | TIMER_16BIT);
+	outb(IO_TIMER1, count % 256);
+	outb(IO_TIMER1, count / 256);
 	irq_setmask_8259A(irq_mask_8259A & ~(1<<0));
-	cprintf("	unmasked timer interrupt\n");
 }
 
+// Stop timer interrupts until kclock_periodic or kclock_oneshot.
+void
+kclock_stop(void)
+{
+	irq_setmask_8259A(irq_mask_8259A | (1<<0));
+}
+
+
+// Measure the TSC frequency, in kHz, by counting cycles while 8253
+// counter 2 counts down 10 ms.  Counter 2 is gated by bit 0 of the PPI
+// port, and its output shows up in bit 5 of the same port.
+uint32_t
+kclock_tsc_khz(void)
+{
+	uint64_t start, end;
+	uint8_t ppi;
+
+	// Gate counter 2 on, with the speaker off.
+	ppi = inb(IO_PPI);
+	outb(IO_PPI, (ppi & ~0x02) | 0x01);
+
+	// In mode 0 the output goes high when the count runs out.
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	outb(TIMER_CNTR2, TIMER_DIV(100) % 256);
+	outb(TIMER_CNTR2, TIMER_DIV(100) / 256);
+	start = read_tsc();
+	while (!(inb(IO_PPI) & 0x20))
+		/* wait */;
+	end = read_tsc();
+
+	outb(IO_PPI, ppi);
+	return (uint32_t) ((end - start) / 10);
+}
@@ -6,6 +6,8 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
 #define	IO_RTC		0x070		/* RTC port */
 
 #define	MC_NVRAM_START	0xe	/* start of NVRAM: offset 14 */
@@ -28,6 +30,10 @@
 
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
-void kclock_init(void);
+void kclock_init(int hz);
+void kclock_periodic(int hz);
+void kclock_oneshot(uint16_t count);
+void kclock_stop(void);
+uint32_t kclock_tsc_khz(void);
 
 #endif	// !JOS_KERN_KCLOCK_H
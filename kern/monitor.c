@@ -13,6 +13,9 @@
 #include <kern/kdebug.h>
 #include <kern/pmap.h>
 #include <kern/trap.h>
+#include <kern/e100.h>
+#include <kern/env.h>
+#include <kern/time.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -33,12 +36,24 @@ static struct Command commands[] = {
 	{ "hexdump", "Dump contents of a range of memory", mon_hexdump },
 	{ "palloc", "Allocate a page of physical memory", mon_palloc },
 	{ "pfree", "Free a page of physical memory", mon_pfree },
-	{ "pstatus", "Display the status of a page of physical memory", mon_pstatus }
+	{ "pstatus", "Display the status of a page of physical memory", mon_pstatus },
+	{ "e100", "Display the E100 DMA ring sizes and drop counters", mon_e100 },
+	{ "top", "Display the environments that have run longest", mon_top }
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
 unsigned read_eip();
 
+// Like pgdir_walk(boot_pgdir, va, 0), but for an address in a 4MB
+// page, such as the kernel's, return the page directory entry.
+static pte_t *
+mon_walk(uintptr_t va)
+{
+	if (boot_pgdir[PDX(va)] & PTE_PS)
+		return &boot_pgdir[PDX(va)];
+	return pgdir_walk(boot_pgdir, (void *) va, 0);
+}
+
 /***** Implementations of basic kernel monitor commands *****/
 
 int
@@ -146,14 +161,17 @@ mon_showmappings(int argc, char **argv, struct Trapframe *tf)
 
 		// Walk the two-level page table structure and get a pointer 
 		// to the page table entry (PTE) for linear address 'va'.
-		pte_t *pte = pgdir_walk(boot_pgdir, (void *) va, 0);
+		pte_t *pte = mon_walk(va);
 			
 		// The Table field acts as an index and determines the entry in the
 		// page table that contains the physical address of the page frame 
 		// containing the page. The offset field then determines the relative 
 		// position within the page giving us the physical address we want.
 		if ((pte) && (*pte & PTE_P)) {
-			pa = PTE_ADDR(*pte) + PGOFF(va);			
+			if (*pte & PTE_PS)
+				pa = PTE_ADDR(*pte) + (va & (PTSIZE - 1));
+			else
+				pa = PTE_ADDR(*pte) + PGOFF(va);
 
 			// Page Table Entry fields to display
 			char p = *pte & PTE_P ? '1' : '0';
@@ -203,7 +221,8 @@ mon_chperm(int argc, char **argv, struct Trapframe *tf)
 
 	// Walk the two-level page table structure and get a pointer 
 	// to the page table entry (PTE) for linear address 'va'.
-	pte_t *pte = pgdir_walk(boot_pgdir, (void *) va, 0);
+	// For a 4MB page, that's its page directory entry.
+	pte_t *pte = mon_walk(va);
 
 	if ((pte) && (*pte & PTE_P)) {
 
@@ -272,7 +291,7 @@ mon_hexdump(int argc, char **argv, struct Trapframe *tf)
 
 		// Walk the two-level page table structure and get a pointer 
 		// to the page table entry (PTE) for linear address 'va'.
-		pte_t *pte = pgdir_walk(boot_pgdir, (void *) va, 0);
+		pte_t *pte = mon_walk(va);
 
 		// If start of a 16-byte row, print the address.
 		if (i == 0) cprintf("%08x ", va);
@@ -368,6 +387,69 @@ mon_pstatus(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_e100(int argc, char **argv, struct Trapframe *tf)
+{
+	e100_stats();
+	return 0;
+}
+
+// Print a column of TSC cycles in milliseconds, or "n/a" if the TSC
+// couldn't be calibrated.
+static void
+print_msec(uint64_t cycles)
+{
+	if (!timepage->tp_tsc_khz)
+		cprintf(" %8s", "n/a");
+	else
+		cprintf(" %8u", (uint32_t) (cycles / timepage->tp_tsc_khz));
+}
+
+// List environments by the time they have spent running, most first,
+// with where the rest of their time went.
+int
+mon_top(int argc, char **argv, struct Trapframe *tf)
+{
+	static struct Env *sorted[NENV];
+	static const char *status[] = { "free", "run", "block", "dying" };
+	int i, j, n = 0, max = 20;
+	struct Env *e;
+
+	if (argc > 2) {
+		cprintf("Usage: top [COUNT]\n");
+		return 0;
+	}
+	if (argc == 2)
+		max = strtol(argv[1], NULL, 0);
+
+	// Insertion sort by run time
+	for (i = 0; i < NENV; i++) {
+		e = &envs[i];
+		if (e->env_status == ENV_FREE)
+			continue;
+		env_account(e);
+		for (j = n++; j > 0 && sorted[j - 1]->env_stat.es_run < e->env_stat.es_run; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = e;
+	}
+
+	cprintf("%d environments, times in ms\n", n);
+	cprintf("   envid status prio cpu     runs      run     wait    block"
+		"   vsw  ivsw  syscalls\n");
+	for (i = 0; i < MIN(n, max); i++) {
+		e = sorted[i];
+		cprintf("%08x %6s %2d/%d %3d %8u", e->env_id,
+			status[e->env_status], e->env_prio, e->env_level,
+			e->env_cpunum, e->env_runs);
+		print_msec(e->env_stat.es_run);
+		print_msec(e->env_stat.es_wait);
+		print_msec(e->env_stat.es_block);
+		cprintf(" %5u %5u %9u\n", e->env_stat.es_vswitch,
+			e->env_stat.es_ivswitch, e->env_stat.es_syscalls);
+	}
+	return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
@@ -21,4 +21,6 @@ int mon_hexdump(int argc, char **argv, struct Trapframe *tf);
 int mon_palloc(int argc, char **argv, struct Trapframe *tf);
 int mon_pfree(int argc, char **argv, struct Trapframe *tf);
 int mon_pstatus(int argc, char **argv, struct Trapframe *tf);
+int mon_e100(int argc, char **argv, struct Trapframe *tf);
+int mon_top(int argc, char **argv, struct Trapframe *tf);
 #endif	// !JOS_KERN_MONITOR_H
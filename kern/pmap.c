@@ -5,10 +5,14 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/trap.h>
 
 #include <kern/pmap.h>
 #include <kern/kclock.h>
+#include <kern/time.h>
 #include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/picirq.h>
 
 // These variables are set by i386_detect_memory()
 static physaddr_t maxpa;	// Maximum physical address
@@ -47,8 +51,8 @@ struct Segdesc gdt[] =
 	// 0x20 - user data segment
 	[GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
 
-	// 0x28 - tss, initialized in idt_init()
-	[GD_TSS >> 3] = SEG_NULL
+	// 0x28 - one tss per CPU, initialized in idt_init_percpu()
+	[(GD_TSS0 >> 3) + NCPU - 1] = SEG_NULL
 };
 
 struct Pseudodesc gdt_pd = {
@@ -88,7 +92,12 @@ i386_detect_memory(void)
 static void check_boot_pgdir(void);
 static void check_page_alloc();
 static void page_check(void);
+
+// Can we map 4MB superpages (CR4_PSE)?
+static bool pse;
+
 static void boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int perm);
+static int page_split(pde_t *pgdir, const void *va);
 
 //
 // A simple physical memory allocator, used only a few times
@@ -151,8 +160,9 @@ void
 i386_vm_init(void)
 {
 	pde_t* pgdir;
-	uint32_t cr0;
+	uint32_t cr0, edx;
 	size_t n;
+	int i;
 
 	//////////////////////////////////////////////////////////////////////
 	// create initial page directory.
@@ -187,6 +197,10 @@ i386_vm_init(void)
 	// Make 'envs' point to an array of size 'NENV' of 'struct Env'.
 	envs = boot_alloc(NENV * sizeof(struct Env), PGSIZE);
 
+	//////////////////////////////////////////////////////////////////////
+	// Allocate the page the kernel publishes its clock in.
+	timepage = boot_alloc(PGSIZE, PGSIZE);
+
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
 	// up the list of free physical pages. Once we've done so, all further
@@ -207,7 +221,7 @@ i386_vm_init(void)
 	//    - the new image at UPAGES -- kernel R, user R
 	//      (ie. perm = PTE_U | PTE_P)
 	//    - pages itself -- kernel RW, user NONE
-	boot_map_segment(boot_pgdir, UPAGES, PTSIZE, PADDR(pages), (PTE_U|PTE_P));	
+	boot_map_segment(boot_pgdir, UPAGES, PTSIZE, PADDR(pages), (PTE_U|PTE_P|PTE_G));	
 
 	//////////////////////////////////////////////////////////////////////
 	// Map the 'envs' array read-only by the user at linear address UENVS
@@ -215,7 +229,16 @@ i386_vm_init(void)
 	// Permissions:
 	//    - the new image at UENVS  -- kernel R, user R
 	//    - envs itself -- kernel RW, user NONE
-	boot_map_segment(boot_pgdir, UENVS, PTSIZE, PADDR(envs), (PTE_U|PTE_P)); 
+	static_assert(NENV * sizeof(struct Env) <= UTIME - UENVS);
+	boot_map_segment(boot_pgdir, UENVS, 
+		ROUNDUP(NENV * sizeof(struct Env), PGSIZE), PADDR(envs), 
+		(PTE_U|PTE_P|PTE_G)); 
+
+	//////////////////////////////////////////////////////////////////////
+	// Map the clock page read-only by the user at linear address UTIME
+	// (ie. perm = PTE_U | PTE_P).
+	boot_map_segment(boot_pgdir, UTIME, PGSIZE, PADDR(timepage), 
+		(PTE_U|PTE_P|PTE_G));
 	
 
 	//////////////////////////////////////////////////////////////////////
@@ -228,7 +251,14 @@ i386_vm_init(void)
 	//       the kernel overflows its stack, it will fault rather than
 	//       overwrite memory.  Known as a "guard page".
 	//     Permissions: kernel RW, user NONE
-	boot_map_segment(boot_pgdir, (KSTACKTOP-KSTKSIZE), KSTKSIZE, PADDR(bootstack), (PTE_W|PTE_P));
+	// Each CPU gets such a stack, CPU i's with its top at 
+	// KSTACKTOP_CPU(i) and KSTKGAP of guard below, backed by 
+	// percpu_kstacks[i]. bootstack is only used until the first 
+	// environment runs.
+	static_assert(KSTACKTOP_CPU(NCPU) >= MMIOLIM);
+	for (i = 0; i < NCPU; i++)
+		boot_map_segment(boot_pgdir, KSTACKTOP_CPU(i) - KSTKSIZE, 
+			KSTKSIZE, PADDR(percpu_kstacks[i]), (PTE_W|PTE_P|PTE_G));
 
 	//////////////////////////////////////////////////////////////////////
 	// Map all of physical memory at KERNBASE. 
@@ -239,7 +269,13 @@ i386_vm_init(void)
 	// Permissions: kernel RW, user NONE
 	// 
 	// size = -KERNBASE = -(f0000000) = 10000000 = 2^32 - KERNBASE
-	boot_map_segment(boot_pgdir, KERNBASE, -KERNBASE, 0x0, (PTE_W|PTE_P));
+	// Use 4MB pages if the processor has them: they need no page
+	// tables and take far fewer TLB entries.
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if ((pse = !!(edx & CPUID_PSE)))
+		lcr4(rcr4() | CR4_PSE);
+	boot_map_segment(boot_pgdir, KERNBASE, -KERNBASE, 0x0, 
+		(PTE_W|PTE_P|PTE_G|(pse ? PTE_PS : 0)));
 
 	// Check that the initial page directory has been set up correctly.
 	check_boot_pgdir();
@@ -292,6 +328,26 @@ i386_vm_init(void)
 
 	// Flush the TLB for good measure, to kill the pgdir[0] mapping.
 	lcr3(boot_cr3);
+
+	// Only now that pgdir[0] is gone, since it shares its page table
+	// with the PTE_G mappings at KERNBASE.
+	tlb_global_init();
+}
+
+//
+// Let the TLB keep the mappings above UTOP, which are the same in every
+// address space and marked PTE_G, when lcr3 switches address spaces.
+// Turning on CR4_PGE also flushes the whole TLB.  Each CPU does this
+// for itself once its low identity mapping is no longer in use.
+//
+void
+tlb_global_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (edx & CPUID_PGE)
+		lcr4(rcr4() | CR4_PGE);
 }
 
 //
@@ -395,13 +451,22 @@ check_boot_pgdir(void)
 	for (i = 0; i < n; i += PGSIZE)
 		assert(check_va2pa(pgdir, UENVS + i) == PADDR(envs) + i);
 
+	// check clock page
+	assert(check_va2pa(pgdir, UTIME) == PADDR(timepage));
+
 	// check phys mem
 	for (i = 0; i < npage * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pgdir, KERNBASE + i) == i);
 
-	// check kernel stack
-	for (i = 0; i < KSTKSIZE; i += PGSIZE)
-		assert(check_va2pa(pgdir, KSTACKTOP - KSTKSIZE + i) == PADDR(bootstack) + i);
+	// check kernel stacks
+	for (n = 0; n < NCPU; n++) {
+		uint32_t base = KSTACKTOP_CPU(n) - KSTKSIZE;
+		for (i = 0; i < KSTKSIZE; i += PGSIZE)
+			assert(check_va2pa(pgdir, base + i)
+			       == PADDR(percpu_kstacks[n]) + i);
+		for (i = 0; i < KSTKGAP; i += PGSIZE)
+			assert(check_va2pa(pgdir, base - KSTKGAP + i) == ~0);
+	}
 	assert(check_va2pa(pgdir, KSTACKTOP - PTSIZE) == ~0);
 
 	// check for zero/non-zero in PDEs
@@ -438,6 +503,8 @@ check_va2pa(pde_t *pgdir, uintptr_t va)
 	pgdir = &pgdir[PDX(va)];
 	if (!(*pgdir & PTE_P))
 		return ~0;
+	if (*pgdir & PTE_PS)
+		return PTE_ADDR(*pgdir) + (va & (PTSIZE - 1) & ~(PGSIZE - 1));
 	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
 	if (!(p[PTX(va)] & PTE_P))
 		return ~0;
@@ -466,8 +533,13 @@ page_init(void)
 	// real-mode IDT and BIOS structures in case we ever need them.
 	pages[0].pp_ref = 1;
 
-	// The rest of base memory is free.
+	// The rest of base memory is free, except for the page the
+	// application processors' startup code is copied to.
 	for (i = 1; i < (basemem/PGSIZE); ++i) {
+		if (i == MPENTRY_PADDR/PGSIZE) {
+			pages[i].pp_ref = 1;
+			continue;
+		}
 		pages[i].pp_ref = 0;
 		LIST_INSERT_HEAD(&page_free_list, &pages[i], pp_link);
 	}
@@ -540,6 +612,55 @@ page_alloc(struct Page **pp_store)
 	else return -E_NO_MEM; // Out of memory!
 }
 
+//
+// Allocates 'n' physically contiguous pages, for devices that need DMA 
+// buffers larger than a page. Like page_alloc, does NOT set the contents 
+// of the pages to zero, NOR does it increment their reference counts.
+//
+// *pp_store -- is set to point to the Page struct of the first page
+// of the run; the rest follow it in the pages array.
+//
+// RETURNS 
+//   0 -- on success
+//   -E_NO_MEM -- if there is no run of 'n' free pages
+//
+int
+page_alloc_npages(struct Page **pp_store, size_t n)
+{
+	return page_alloc_aligned(pp_store, n, 1);
+}
+
+//
+// Like page_alloc_npages, but the first page's page number is a
+// multiple of 'align', as a superpage's must be.
+//
+int
+page_alloc_aligned(struct Page **pp_store, size_t n, size_t align)
+{
+	size_t i, run = 0;
+
+	// A page is on the free list iff its pp_link is linked in,
+	// since page_initpp clears the link of every allocated page.
+	for (i = 0; i < npage; i++) {
+		if (pages[i].pp_ref || !pages[i].pp_link.le_prev ||
+		    (run == 0 && i % align != 0)) {
+			run = 0;
+			continue;
+		}
+		if (++run < n)
+			continue;
+
+		// Found a long enough run ending at page i.
+		for (i = i + 1 - n; run > 0; run--, i++) {
+			LIST_REMOVE(&pages[i], pp_link);
+			page_initpp(&pages[i]);
+		}
+		*pp_store = &pages[i - n];
+		return 0;
+	}
+	return -E_NO_MEM;
+}
+
 //
 // Return a page to the free list.
 // (This function should only be called when pp->pp_ref reaches 0.)
@@ -590,6 +711,10 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 	uintptr_t pdx = PDX(va); // Directory field
 	uintptr_t ptx = PTX(va); // Table field
 
+	// A superpage has no page table, unless we split it into one.
+	if ((pgdir[pdx] & PTE_PS) && (!create || page_split(pgdir, va) < 0))
+		return NULL;
+
 	// The Directory field is the index into the page directory that determines 
 	// the entry that points to the proper page table. This entry contains the 
 	// physical address of the Page Table.
@@ -617,6 +742,37 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 	return ptep;
 }
 
+//
+// Replace the superpage mapping that covers 'va' with a page table
+// mapping the same 1024 pages with the same permissions, so that
+// they can be remapped one at a time.  The accessed and dirty bits
+// of the superpage carry over to every one of its pages.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if the page table couldn't be allocated
+//
+static int
+page_split(pde_t *pgdir, const void *va)
+{
+	struct Page *pp;
+	pte_t *pt;
+	pde_t pde = pgdir[PDX(va)];
+	int i;
+
+	if (page_alloc(&pp) < 0)
+		return -E_NO_MEM;
+	pp->pp_ref = 1;
+	pt = page2kva(pp);
+	for (i = 0; i < NPTENTRIES; i++)
+		pt[i] = (PTE_ADDR(pde) + i * PGSIZE) | 
+			(pde & (PTE_USER | PTE_A | PTE_D));
+
+	pgdir[PDX(va)] = page2pa(pp)|PTE_U|PTE_W|PTE_P;
+	tlb_invalidate(pgdir, ROUNDDOWN((void *) va, PTSIZE));
+	return 0;
+}
+
 //
 // Map the physical page 'pp' at virtual address 'va'.
 // The permissions (the low 12 bits) of the page table
@@ -669,6 +825,71 @@ page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm)
 	else return -E_NO_MEM; // Page table couldn't be allocated
 }
 
+//
+// Can page_insert_super map superpages on this processor?
+//
+bool
+page_super_supported(void)
+{
+	return pse;
+}
+
+//
+// Map the 4MB superpage starting at 'pp' (1024 physically contiguous
+// pages, the first's page number a multiple of 1024) at the 4MB-aligned
+// virtual address 'va', with permissions 'perm|PTE_PS|PTE_P'.
+// Whatever was mapped in that 4MB is unmapped, and each of the 1024
+// pages gains a reference, so the superpage can later be split up or
+// unmapped a page at a time like any others.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL, if the processor doesn't support superpages
+//
+int
+page_insert_super(pde_t *pgdir, struct Page *pp, void *va, int perm)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	int i;
+
+	if (!pse)
+		return -E_INVAL;
+
+	// Take the new references first, in case pp is already mapped here.
+	for (i = 0; i < NPTENTRIES; i++)
+		pp[i].pp_ref++;
+
+	if (*pde & PTE_PS)
+		page_remove_super(pgdir, va);
+	else if (*pde & PTE_P) {
+		for (i = 0; i < NPTENTRIES; i++)
+			page_remove(pgdir, va + i * PGSIZE);
+		page_decref(pa2page(PTE_ADDR(*pde)));
+		*pde = 0;
+	}
+
+	*pde = page2pa(pp)|perm|PTE_PS|PTE_P;
+	tlb_invalidate(pgdir, va);
+	return 0;
+}
+
+//
+// Unmap the whole superpage that covers 'va', dropping a reference to
+// each of its pages.
+//
+void
+page_remove_super(pde_t *pgdir, void *va)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct Page *pp = pa2page(PTE_ADDR(*pde));
+	int i;
+
+	*pde = 0;
+	for (i = 0; i < NPTENTRIES; i++)
+		page_decref(&pp[i]);
+	tlb_invalidate(pgdir, ROUNDDOWN(va, PTSIZE));
+}
+
 //
 // Map [la, la+size) of linear address space to physical [pa, pa+size)
 // in the page table rooted at pgdir.  Size is a multiple of PGSIZE.
@@ -683,6 +904,14 @@ static void
 boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int perm)
 {
 	size_t i;	
+
+	// With PTE_PS, fill in page directory entries mapping 4MB each.
+	if (perm & PTE_PS) {
+		for (i = 0; i < size; i += PTSIZE)
+			pgdir[PDX(la+i)] = (pa+i)|perm|PTE_P;
+		return;
+	}
+
 	for (i = 0; i < size; i += PGSIZE) {
 		// Find the page table entry for each linear address
 		// If it doesn't exist then we try to create one.
@@ -694,6 +923,86 @@ boot_map_segment(pde_t *pgdir, uintptr_t la, size_t size, physaddr_t pa, int per
 	}
 }
 
+//
+// Map every user page that pgdir 'src' maps below 'limit' at the same
+// address in 'dst', for fork. Writable and copy-on-write pages become
+// copy-on-write in both address spaces, unless marked PTE_SHARE; other
+// pages are simply shared.
+// The caller must flush the TLB if 'src' is the current address space.
+//
+// RETURNS: 
+//   0 on success
+//   -E_NO_MEM, if a page table couldn't be allocated
+//
+int
+page_copy_cow(pde_t *dst, pde_t *src, uintptr_t limit)
+{
+	uint32_t pdeno, pteno;
+	pte_t *pt;
+	void *va;
+	int perm;
+
+	for (pdeno = 0; pdeno <= PDX(limit - 1); pdeno++) {
+		if (!(src[pdeno] & PTE_P))
+			continue;
+
+		// Share a read-only superpage that's entirely below limit;
+		// split any other, so it can be copied on write a page at a
+		// time.
+		va = PGADDR(pdeno, 0, 0);
+		if ((src[pdeno] & PTE_PS) && 
+		    !(src[pdeno] & (PTE_W|PTE_COW)) && va + PTSIZE <= (void *) limit) {
+			page_insert_super(dst, pa2page(PTE_ADDR(src[pdeno])), va,
+				src[pdeno] & PTE_USER);
+			continue;
+		}
+		if ((src[pdeno] & PTE_PS) && !pgdir_walk(src, va, 1))
+			return -E_NO_MEM;
+
+		pt = KADDR(PTE_ADDR(src[pdeno]));
+		for (pteno = 0; pteno < NPTENTRIES; pteno++) {
+			va = PGADDR(pdeno, pteno, 0);
+			if ((uintptr_t) va >= limit)
+				break;
+			if (!(pt[pteno] & PTE_P))
+				continue;
+
+			perm = pt[pteno] & PTE_USER;
+			if (!(perm & PTE_SHARE) && (perm & (PTE_W|PTE_COW))) {
+				perm = (perm & ~PTE_W) | PTE_COW;
+				pt[pteno] = PTE_ADDR(pt[pteno]) | perm;
+			}
+			if (page_insert(dst, pa2page(PTE_ADDR(pt[pteno])), va, perm) < 0)
+				return -E_NO_MEM;
+		}
+	}
+	return 0;
+}
+
+//
+// Reserve size bytes in the MMIO region and map [pa,pa+size) at this
+// location.  Return the base of the reserved region.  size does *not*
+// have to be multiple of PGSIZE.
+//
+// The mappings are cache-disabled and write-through, as device memory
+// requires. Like boot_map_segment, this is only used at boot, before
+// any environment copies the kernel's part of boot_pgdir.
+//
+void *
+mmio_map_region(physaddr_t pa, size_t size)
+{
+	static uintptr_t base = MMIOBASE;
+	uintptr_t va = base;
+
+	size = ROUNDUP(pa + size, PGSIZE) - ROUNDDOWN(pa, PGSIZE);
+	if (base + size > MMIOLIM)
+		panic("mmio_map_region: out of MMIO space");
+	boot_map_segment(boot_pgdir, base, size, ROUNDDOWN(pa, PGSIZE),
+		PTE_PCD|PTE_PWT|PTE_W|PTE_G);
+	base += size;
+	return (void *) (va + PGOFF(pa));
+}
+
 //
 // Return the page mapped at virtual address 'va'.
 // If pte_store is not zero, then we store in it the address
@@ -709,12 +1018,19 @@ struct Page *
 page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 {
 	struct Page *pp = NULL;
+	pde_t *pde = &pgdir[PDX(va)];
+
+	// Inside a superpage, the page directory entry holds the permissions.
+	if ((*pde & PTE_P) && (*pde & PTE_PS)) {
+		if (pte_store) *pte_store = pde;
+		return pa2page(PTE_ADDR(*pde)) + PTX(va);
+	}
 
 	// Get the page table entry mapped at virtual address va
 	// Do NOT create if no page is mapped
 	pte_t *ptep = pgdir_walk(pgdir, va, 0);
 
-	if (ptep) { // We found the page
+	if (ptep && (*ptep & PTE_P)) { // We found the page
 		// Store it?
 		if (pte_store) *pte_store = ptep;
 
@@ -742,10 +1058,19 @@ page_lookup(pde_t *pgdir, void *va, pte_t **pte_store)
 void
 page_remove(pde_t *pgdir, void *va)
 {
+	pte_t *ptep = NULL;
+	struct Page *pp;
+
+	// Split a superpage so as to unmap just the one page of it, or if
+	// there's no memory for that, unmap the lot.
+	if ((pgdir[PDX(va)] & PTE_PS) && !pgdir_walk(pgdir, va, 1)) {
+		page_remove_super(pgdir, va);
+		return;
+	}
+
 	// Lookup the page mapped at virtual address va and
 	// store the address of the page table entry for it
-	pte_t *ptep = NULL;
-	struct Page *pp = page_lookup(pgdir, va, &ptep);
+	pp = page_lookup(pgdir, va, &ptep);
 
 	if (pp) { // We found a page at the given address
 		page_decref(pp);
@@ -756,16 +1081,111 @@ page_remove(pde_t *pgdir, void *va)
 	// No page found, silently do nothing...
 }
 
+// Invalidations put off by tlb_defer. Past TLB_MAXPENDING of them a
+// full flush is cheaper than one invlpg each.
+#define TLB_MAXPENDING	32
+static bool tlb_deferred;
+static int tlb_npending;
+static void *tlb_pending[TLB_MAXPENDING];
+// Address space whose shootdown is put off by tlb_defer, if any.
+static pde_t *tlb_remote;
+
+//
+// Make every other CPU running in the address space 'pgdir' flush its
+// TLB, and wait until it has.  A CPU in user mode gets an IRQ_TLB
+// interrupt, which trap() answers without the big kernel lock we hold.
+// A CPU already in the kernel is spinning for that lock and flushes
+// as soon as it gets it, before it can use a user mapping, so there's
+// no waiting for it.
+//
+static void
+tlb_shootdown(pde_t *pgdir)
+{
+	struct CpuInfo *c;
+
+	for (c = cpus; c < cpus + ncpu; c++)
+		if (c != thiscpu && c->cpu_env && c->cpu_env->env_pgdir == pgdir) {
+			c->cpu_tlbflush = 1;
+			lapic_ipi(c->cpu_id, IRQ_OFFSET + IRQ_TLB);
+		}
+	for (c = cpus; c < cpus + ncpu; c++)
+		while (c->cpu_tlbflush && !c->cpu_inkernel)
+			asm volatile("pause");
+}
+
+//
+// Carry out a TLB shootdown requested of this CPU by tlb_shootdown.
+//
+void
+tlb_shootdown_ack(void)
+{
+	if (thiscpu->cpu_tlbflush) {
+		lcr3(rcr3());
+		thiscpu->cpu_tlbflush = 0;
+	}
+}
+
 //
-// Invalidate a TLB entry, but only if the page tables being
-// edited are the ones currently in use by the processor.
+// Invalidate a TLB entry, both on this CPU, if the page tables being
+// edited are the ones it is using, and on the other CPUs using them.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
-	// Flush the entry only if we're modifying the current address space.
-	if (!curenv || curenv->env_pgdir == pgdir)
+	if (!tlb_deferred)
+		tlb_shootdown(pgdir);
+	else if (tlb_remote != pgdir) {
+		if (tlb_remote)
+			tlb_shootdown(tlb_remote);
+		tlb_remote = pgdir;
+	}
+
+	// Flush the local entry only if we're modifying the address space this
+	// CPU is using; the TLB holds no other address space's user
+	// mappings.
+	if (PADDR(pgdir) != rcr3())
+		return;
+	if (!tlb_deferred)
 		invlpg(va);
+	else if (tlb_npending < TLB_MAXPENDING)
+		tlb_pending[tlb_npending++] = va;
+	else
+		tlb_npending = TLB_MAXPENDING + 1;	// flush everything
+}
+
+//
+// Put off the TLB invalidations of subsequent tlb_invalidate calls
+// until tlb_flush, so a batch of page table changes costs one flush.
+// Until then the TLB may hold stale entries for the current address
+// space, so the kernel mustn't access user memory through them.
+//
+void
+tlb_defer(void)
+{
+	tlb_deferred = 1;
+	tlb_npending = 0;
+	tlb_remote = NULL;
+}
+
+//
+// Carry out the invalidations put off since tlb_defer: one invlpg
+// each if there are only a few, otherwise a flush of the whole TLB.
+//
+void
+tlb_flush(void)
+{
+	int i;
+
+	if (tlb_npending > TLB_MAXPENDING)
+		lcr3(rcr3());
+	else
+		for (i = 0; i < tlb_npending; i++)
+			invlpg(tlb_pending[i]);
+	if (tlb_remote)
+		tlb_shootdown(tlb_remote);
+	tlb_deferred = 0;
+	tlb_npending = 0;
+	tlb_remote = NULL;
 }
 
 static uintptr_t user_mem_check_addr;
@@ -809,8 +1229,11 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 			return -E_FAULT;
 		}
 
-		// Get the page table entry for this address.
-		ptep = pgdir_walk(env->env_pgdir, addr+i, 0);
+		// Get the page table entry for this address, or the page
+		// directory entry for a superpage.
+		ptep = &env->env_pgdir[PDX(addr+i)];
+		if (!(*ptep & PTE_PS))
+			ptep = pgdir_walk(env->env_pgdir, addr+i, 0);
 
 		// Is the page table mapped?
 		if ((!ptep) || (!(*ptep & PTE_P))) {
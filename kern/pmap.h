@@ -53,13 +53,24 @@ void	i386_detect_memory();
 
 void	page_init(void);
 int	page_alloc(struct Page **pp_store);
+int	page_alloc_npages(struct Page **pp_store, size_t n);
+int	page_alloc_aligned(struct Page **pp_store, size_t n, size_t align);
 void	page_free(struct Page *pp);
 int	page_insert(pde_t *pgdir, struct Page *pp, void *va, int perm);
+int	page_copy_cow(pde_t *dst, pde_t *src, uintptr_t limit);
+bool	page_super_supported(void);
+int	page_insert_super(pde_t *pgdir, struct Page *pp, void *va, int perm);
+void	page_remove_super(pde_t *pgdir, void *va);
 void	page_remove(pde_t *pgdir, void *va);
 struct Page *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct Page *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
+void	tlb_global_init(void);
+void	tlb_defer(void);
+void	tlb_flush(void);
+void	tlb_shootdown_ack(void);
+void	*mmio_map_region(physaddr_t pa, size_t size);
 
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
@@ -1,49 +1,255 @@
 #include <inc/assert.h>
+#include <inc/x86.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/sched.h>
+#include <kern/time.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
 
+// Clock ticks an environment may run for at each priority level before it
+// is preempted and demoted. Lower levels get longer quanta, so CPU-bound
+// environments are interrupted less once they have sunk to the bottom.
+#define SCHED_QUANTUM(level)	(1 << (level))
+
+// Clock ticks between moving every environment back to its base priority
+// level, so environments that have been demoted can't starve.
+#define SCHED_BOOST_TICKS	100
+
+// Each CPU has a run queue for each priority level, holding every
+// RUNNABLE environment at that level whose env_cpunum is that CPU,
+// except the idle environment, in the order they are going to be run.
+// An environment stays on the queue while it runs. env_set_status keeps
+// the queues up to date.
+static struct Env_tailq runq[NCPU][ENV_NPRIO];
+static int boost_ticks;
+
+// Number of NOT_RUNNABLE environments, including those sleeping with a
+// timeout. env_set_status keeps it up to date too.
+static int nblocked;
+
+void
+sched_init(void)
+{
+	int i, j;
+
+	for (i = 0; i < NCPU; i++)
+		for (j = 0; j < ENV_NPRIO; j++)
+			TAILQ_INIT(&runq[i][j]);
+}
+
+// Add a newly runnable environment at the end of its level's run queue.
+void
+sched_enqueue(struct Env *e)
+{
+	if (e != &envs[0])
+		TAILQ_INSERT_TAIL(&runq[e->env_cpunum][e->env_level], e,
+			env_runlink);
+}
+
+// Remove an environment that is no longer runnable from its run queue.
+void
+sched_dequeue(struct Env *e)
+{
+	if (e != &envs[0])
+		TAILQ_REMOVE(&runq[e->env_cpunum][e->env_level], e, env_runlink);
+}
+
+// Count an environment that has just become NOT_RUNNABLE.
+void
+sched_block(struct Env *e)
+{
+	nblocked++;
+}
+
+// Stop counting an environment that is no longer NOT_RUNNABLE.
+void
+sched_unblock(struct Env *e)
+{
+	nblocked--;
+}
+
+// Move environment e to priority level 'level' with a fresh quantum.
+void
+sched_setlevel(struct Env *e, int level)
+{
+	bool queued = (e->env_status == ENV_RUNNABLE);
+
+	if (queued)
+		sched_dequeue(e);
+	e->env_level = level;
+	e->env_ticks = 0;
+	if (queued)
+		sched_enqueue(e);
+}
+
+// Move environment e to CPU 'cpu's run queues.
+void
+sched_migrate(struct Env *e, int cpu)
+{
+	bool queued = (e->env_status == ENV_RUNNABLE);
+
+	if (queued)
+		sched_dequeue(e);
+	e->env_cpunum = cpu;
+	if (queued)
+		sched_enqueue(e);
+}
+
+// Is e running on some CPU right now?
+bool
+sched_oncpu(struct Env *e)
+{
+	return cpus[e->env_cpunum].cpu_env == e;
+}
+
+// The environment that has waited longest on CPU 'cpu's run queue for
+// 'level', not counting the one that CPU is running, or NULL.
+static struct Env *
+sched_waiting(int cpu, int level)
+{
+	struct Env *e;
+
+	TAILQ_FOREACH(e, &runq[cpu][level], env_runlink)
+		if (cpus[cpu].cpu_env != e)
+			return e;
+	return NULL;
+}
+
+// Is there an environment that should run instead of e, because it's
+// runnable at a higher priority level, on this CPU or on one it could
+// be stolen from?
+bool
+sched_preempt(struct Env *e)
+{
+	int i, j;
+
+	for (i = 0; i < e->env_level; i++)
+		for (j = 0; j < ncpu; j++)
+			if (sched_waiting(j, i))
+				return 1;
+	return 0;
+}
+
+// Account for a clock tick. Called on every timer interrupt, on every CPU.
+// Returns only if the current environment can keep running; otherwise
+// it calls sched_yield, which doesn't.
+void
+sched_tick(void)
+{
+	int i, j;
+	struct Env *e, *next;
+
+	if (thiscpu == bootcpu && ++boost_ticks >= SCHED_BOOST_TICKS) {
+		boost_ticks = 0;
+		for (j = 0; j < ncpu; j++)
+			for (i = 1; i < ENV_NPRIO; i++)
+				for (e = TAILQ_FIRST(&runq[j][i]); e; e = next) {
+					next = TAILQ_NEXT(e, env_runlink);
+					if (e->env_prio < i)
+						sched_setlevel(e, e->env_prio);
+				}
+		if (curenv && curenv->env_level != curenv->env_prio)
+			sched_setlevel(curenv, curenv->env_prio);
+	}
+
+	if (!curenv || curenv == &envs[0])
+		sched_yield();
+
+	// An environment that uses up its whole quantum is CPU-bound,
+	// so demote it to a lower priority level.
+	if (++curenv->env_ticks >= SCHED_QUANTUM(curenv->env_level)) {
+		sched_setlevel(curenv, MIN(curenv->env_level + 1, ENV_NPRIO - 1));
+		curenv->env_preempted = 1;
+		sched_yield();
+	}
+}
+
+// Is a CPU other than this one running an environment?
+static bool
+sched_busy(void)
+{
+	int i;
+
+	for (i = 0; i < ncpu; i++)
+		if (&cpus[i] != thiscpu && cpus[i].cpu_env)
+			return 1;
+	return 0;
+}
+
+// Wait for an interrupt with the CPU halted. Whatever was on the kernel
+// stack is abandoned, since the interrupt ends in sched_yield or env_run
+// and never returns here.
+static void
+sched_halt(void)
+{
+	if (curenv)
+		env_account(curenv);
+	curenv = NULL;
+	lcr3(boot_cr3);
+
+	// Record that this CPU is halted, so trap() knows to take the big
+	// kernel lock again when an interrupt wakes it up.
+	xchg(&thiscpu->cpu_status, CPU_HALTED);
+	unlock_kernel();
+
+	asm volatile("movl %0, %%esp\n"
+		     "sti\n"
+		     "1: hlt\n"
+		     "jmp 1b\n" : : "r" (thiscpu->cpu_ts.ts_esp0));
+}
 
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
 {
-	// Implement simple round-robin scheduling.
-	// Search through 'envs' for a runnable environment,
-	// in circular fashion starting after the previously running env,
-	// and switch to the first such environment found.
-	// It's OK to choose the previously running env if no other env
-	// is runnable.
+	// Implement multilevel round-robin scheduling.
+	// Run the environment that has waited longest at the highest priority
+	// level with a runnable environment, after moving the previously
+	// running environment (if it is still runnable) to the end of its
+	// level's queue. It's OK to choose the previously running env if no
+	// other env is runnable.
+	// At each level, this CPU's own queue comes first; if it is empty,
+	// steal an environment waiting on another CPU's.
 	// But never choose envs[0], the idle environment,
 	// unless NOTHING else is runnable.
 
-	int i, k;
-	bool search = 1;
+	int i, j, me = cpunum();
+	struct Env *e;
 
-	// Get the offset into envs of the currently running environment.
-	k = curenv ? ENVX(curenv->env_id) : 0;	
-	i = k+1;
+	if (curenv && curenv != &envs[0] && curenv->env_status == ENV_RUNNABLE) {
+		TAILQ_REMOVE(&runq[me][curenv->env_level], curenv, env_runlink);
+		TAILQ_INSERT_TAIL(&runq[me][curenv->env_level], curenv, env_runlink);
+	}
 
-	while (search) {
-		if (envs[i].env_status == ENV_RUNNABLE) {
-			env_run(&envs[i]);
-			search = 0;
+	for (i = 0; i < ENV_NPRIO; i++) {
+		e = TAILQ_FIRST(&runq[me][i]);
+		for (j = 0; !e && j < ncpu; j++)
+			if (j != me)
+				e = sched_waiting(j, i);
+		if (e) {
+			if (thiscpu == bootcpu)
+				time_resume();
+			env_run(e);
 		}
-		++i;
-		if (i % NENV == 0) i = 1;
-		if (i == k+1) search = 0;
 	}
 
-	// If we went through all the envs and found none runnable, we proceed
-	// and run the special idle environment, otherwise we must have started
-	// a runnable environment and can just return.
-	if (i != k+1) return; 
+	// Only the boot CPU runs the idle environment, and only once no
+	// other CPU has anything to do. In tickless mode, rather than run
+	// it while others are blocked, halt with the clock stopped until an
+	// interrupt wakes one of them up.
+	if (thiscpu != bootcpu || sched_busy())
+		sched_halt();
+	if (time_tickless() && nblocked > 0 && time_idle())
+		sched_halt();
 
 	// Run the special idle environment when nothing else is runnable.
-	if (envs[0].env_status == ENV_RUNNABLE)
+	if (envs[0].env_status == ENV_RUNNABLE) {
+		time_resume();
 		env_run(&envs[0]);
-	else {
+	} else {
 		cprintf("Destroyed all environments - nothing more to do!\n");
 		while (1)
 			monitor(NULL);
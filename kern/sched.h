@@ -6,6 +6,21 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
+struct Env;
+
+void sched_init(void);
+void sched_enqueue(struct Env *e);
+void sched_dequeue(struct Env *e);
+void sched_block(struct Env *e);
+void sched_unblock(struct Env *e);
+void sched_setlevel(struct Env *e, int level);
+void sched_migrate(struct Env *e, int cpu);
+bool sched_oncpu(struct Env *e);
+void sched_tick(void);
+bool sched_preempt(struct Env *e);
+
 // This function does not return.
 void sched_yield(void) __attribute__((noreturn));
 
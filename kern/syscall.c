@@ -64,6 +64,7 @@ sys_env_destroy(envid_t envid)
 static void
 sys_yield(void)
 {
+	curenv->env_stat.es_vswitch++;
 	sched_yield();
 }
 
@@ -87,10 +88,14 @@ sys_exofork(void)
 	if ((r = env_alloc(&child, parent->env_id)) < 0)
 		return r;
 
-	child->env_status = ENV_NOT_RUNNABLE;
+	env_set_status(child, ENV_NOT_RUNNABLE);
 	child->env_tf = parent->env_tf;
 	child->env_tf.tf_regs.reg_eax = 0;
 
+	// The child inherits its parent's base priority.
+	child->env_prio = parent->env_prio;
+	sched_setlevel(child, child->env_prio);
+
 	return child->env_id;
 }
 
@@ -119,7 +124,59 @@ sys_env_set_status(envid_t envid, int status)
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
 
-	e->env_status = status;
+	env_set_status(e, status);
+	return 0;
+}
+
+// Set envid's base priority level to prio, 0 being the highest, and move it
+// to that level right away. Environments that get demoted for using up 
+// their quanta return to their base priority level when they block in IPC.
+// Any environment may lower its own or its children's priority, but only
+// the servers the kernel starts at boot (env_server: the file and network
+// servers) may raise any priority at will; a parent may raise its 
+// child's, but no higher than its own.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if prio is not a valid priority level.
+static int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	int r;
+	struct Env *e = NULL;
+
+	if ((prio < 0) || (prio >= ENV_NPRIO))
+		return -E_INVAL;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (prio < e->env_prio && !curenv->env_server
+	    && (e == curenv || prio < curenv->env_prio))
+		return -E_BAD_ENV;
+
+	e->env_prio = prio;
+	sched_setlevel(e, prio);
+	return 0;
+}
+
+// Copy envid's CPU accounting into *st. Any environment may read any
+// other's, so that a monitoring program can watch them all.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_env_stat(envid_t envid, struct Envstat *st)
+{
+	int r;
+	struct Env *e;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	user_mem_assert(curenv, st, sizeof(*st), PTE_P|PTE_U|PTE_W);
+
+	env_account(e);
+	*st = e->env_stat;
 	return 0;
 }
 
@@ -236,6 +293,48 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	return 0;
 }
 
+// Allocate a 4MB superpage of physically contiguous memory, map it at
+// 'va' with permission 'perm' in the address space of 'envid', and
+// zero it, as sys_page_alloc does for a page.  It takes one TLB entry
+// instead of 1024.  Each of its pages can still be mapped elsewhere,
+// or remapped or unmapped in place, which splits it into ordinary
+// pages.  Note that vpt doesn't describe a superpage: check
+// vpd[PDX(va)] & PTE_PS.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va >= UTOP, or va is not 4MB-aligned.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if the processor doesn't support superpages.
+//	-E_NO_MEM if there's no 4MB-aligned run of free memory.
+static int
+sys_page_alloc_super(envid_t envid, void *va, int perm)
+{
+	int r;
+	struct Env *e;
+	struct Page *pp;
+
+	if (va >= (void *) UTOP || (uintptr_t) va % PTSIZE != 0)
+		return -E_INVAL;
+	if (!(perm & (PTE_U|PTE_P)) || (perm & ~PTE_USER))
+		return -E_INVAL;
+	if (!page_super_supported())
+		return -E_INVAL;
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+
+	if ((r = page_alloc_aligned(&pp, NPTENTRIES, NPTENTRIES)) < 0)
+		return r;
+	memset(page2kva(pp), 0, PTSIZE);
+	if ((r = page_insert_super(e->env_pgdir, pp, va, perm)) < 0) {
+		for (r = 0; r < NPTENTRIES; r++)
+			page_free(&pp[r]);
+		return -E_INVAL;
+	}
+	return 0;
+}
+
 // Map the page of memory at 'srcva' in srcenvid's address space
 // at 'dstva' in dstenvid's address space with permission 'perm'.
 // Perm has the same restrictions as in sys_page_alloc, except
@@ -285,7 +384,7 @@ sys_page_map(envid_t srcenvid, void *srcva,
 
 	// check is srcva mapped in srcenvid's address space.
 	pp = page_lookup(src->env_pgdir, srcva, &pt);
-	if (!(*pt & PTE_P)) 
+	if (!pp || !(*pt & PTE_P)) 
 		return -E_INVAL;
 
 	// check if (perm & PTE_W), but srcva is read-only in srcenvid's address space.
@@ -331,22 +430,327 @@ sys_page_unmap(envid_t envid, void *va)
 	return 0;
 }
 
+// Carry out page operation *op for sys_page_batch, counting it down
+// as it goes.
+static int
+sys_page_op(envid_t srcenvid, envid_t dstenvid, struct Pageop *op)
+{
+	int r;
+
+	for (; op->po_npages > 0; op->po_npages--) {
+		if (op->po_op == PAGEOP_ALLOC)
+			r = sys_page_alloc(dstenvid, op->po_dstva, op->po_perm);
+		else if (op->po_op == PAGEOP_MAP)
+			r = sys_page_map(srcenvid, op->po_srcva, dstenvid,
+					 op->po_dstva, op->po_perm);
+		else if (op->po_op == PAGEOP_UNMAP)
+			r = sys_page_unmap(dstenvid, op->po_dstva);
+		else
+			r = -E_INVAL;
+		if (r < 0)
+			return r;
+		op->po_srcva += PGSIZE;
+		op->po_dstva += PGSIZE;
+	}
+	return 0;
+}
+
+// Number of page operations sys_page_batch copies in at a time.
+#define PAGEOP_CHUNK	16
+
+// Apply the 'nops' page operations in 'ops' (see struct Pageop) in
+// order, flushing the TLB once per PAGEOP_CHUNK operations rather than
+// for every page.  Each page is checked just as the corresponding
+// single-page system call would check it.
+//
+// Operations are consumed as they are carried out: po_npages counts
+// down to 0, and po_srcva and po_dstva move on to the next page.  So
+// if one fails, ops shows exactly how far the batch got: the first
+// operation with po_npages > 0 failed on its po_dstva.  (Unless the
+// batch unmapped ops itself.)
+//
+// Return 0 on success, < 0 on error.  Errors are those of
+// sys_page_alloc, sys_page_map and sys_page_unmap, and:
+//	-E_INVAL if po_op isn't a PAGEOP_*.
+static int
+sys_page_batch(envid_t srcenvid, envid_t dstenvid, struct Pageop *ops,
+	       unsigned nops)
+{
+	unsigned i, j, n;
+	int r = 0;
+	struct Pageop chunk[PAGEOP_CHUNK];
+
+	for (i = 0; i < nops && r >= 0; i += n) {
+		n = MIN(nops - i, PAGEOP_CHUNK);
+		user_mem_assert(curenv, ops + i, n * sizeof(*ops), 
+				PTE_P|PTE_U|PTE_W);
+		memmove(chunk, ops + i, n * sizeof(*ops));
+
+		tlb_defer();
+		for (j = 0; j < n && r >= 0; j++)
+			r = sys_page_op(srcenvid, dstenvid, &chunk[j]);
+		tlb_flush();
+
+		if (user_mem_check(curenv, ops + i, n * sizeof(*ops),
+				   PTE_P|PTE_U|PTE_W) == 0)
+			memmove(ops + i, chunk, n * sizeof(*ops));
+	}
+	return r;
+}
+
+// Create a runnable child that is a copy-on-write clone of the current
+// environment, in one system call: every writable or copy-on-write page
+// below the user exception stack is marked copy-on-write in both, other
+// pages are shared, and the child gets a fresh exception stack and the
+// parent's page fault upcall, which must resolve copy-on-write faults.
+// Returns envid of the child to the parent and 0 to the child,
+// or < 0 on error.  Errors are:
+//	-E_INVAL if the current environment has no page fault upcall.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_fork(void)
+{
+	int r;
+	envid_t envid;
+	struct Env *child;
+	void *xstack = (void *) (UXSTACKTOP - PGSIZE);
+
+	if (!curenv->env_pgfault_upcall)
+		return -E_INVAL;
+	if ((envid = sys_exofork()) < 0)
+		return envid;
+	child = &envs[ENVX(envid)];
+
+	r = page_copy_cow(child->env_pgdir, curenv->env_pgdir, 
+		(uintptr_t) xstack);
+	// Our writable pages just became read-only
+	lcr3(curenv->env_cr3);
+	if (r < 0)
+		goto fail;
+
+	// The page fault handler runs on the exception stack, so it
+	// can't be copy-on-write.
+	if (page_lookup(curenv->env_pgdir, xstack, NULL) &&
+	    (r = sys_page_alloc(envid, xstack, PTE_P|PTE_U|PTE_W)) < 0)
+		goto fail;
+
+	child->env_pgfault_upcall = curenv->env_pgfault_upcall;
+	env_set_status(child, ENV_RUNNABLE);
+	return envid;
+
+fail:
+	env_free(child);
+	return r;
+}
+
+// Is dst blocked in sys_ipc_recv or sys_ipc_call, ready to take a message 
+// from src? An environment waiting for a reply in sys_ipc_call only takes 
+// messages from the environment it called; others get queued.
+static bool
+ipc_recving_from(struct Env *dst, struct Env *src)
+{
+	return dst->env_ipc_recving && (dst->env_ipc_from == 0) &&
+		(!dst->env_ipc_waitfrom || (dst->env_ipc_waitfrom == src->env_id));
+}
+
+// Complete the receive dst is blocked in with a message from curenv.
+static void
+ipc_finish(struct Env *dst, uint32_t value)
+{
+	dst->env_ipc_recving = 0; // block future requests
+	dst->env_ipc_waitfrom = 0;
+	dst->env_ipc_from = curenv->env_id;
+	dst->env_ipc_value = value;
+	dst->env_tf.tf_regs.reg_eax = 0;
+	env_set_status(dst, ENV_RUNNABLE);
+}
+
+// Look up the page curenv has mapped at 'va' to send with permissions
+// 'perm', checking it as sys_ipc_try_send describes.
+static int
+ipc_lookup_page(void *va, unsigned perm, struct Page **pp_store)
+{
+	pte_t *pte;
+
+	if (va >= (void *) UTOP || PGOFF(va) != 0)
+		return -E_INVAL;
+	if (!(*pp_store = page_lookup(curenv->env_pgdir, va, &pte)))
+		// page not mapped in the caller's address space.
+		return -E_INVAL;
+	if (!(*pte & PTE_W) && (perm & PTE_W))
+		// va is read-only in the current environment's address space.
+		return -E_INVAL;
+	return 0;
+}
+
+// Map the 'npages' pages pp[0], ... one after another at the dstva 
+// that dst, which is blocked receiving, asked for, if it asked for 
+// pages at all.  Either all of them are mapped or, on error, none are.
+static int
+ipc_map_pages(struct Env *dst, struct Page **pp, unsigned npages, 
+	      unsigned perm)
+{
+	int r;
+	unsigned i;
+
+	if (npages == 0 || !dst->env_ipc_dstva) {
+		dst->env_ipc_perm = 0;
+		dst->env_ipc_npages = 0;
+		return 0;
+	}
+	if (npages > dst->env_ipc_maxpages)
+		return -E_INVAL;
+	for (i = 0; i < npages; i++)
+		if ((r = page_insert(dst->env_pgdir, pp[i], 
+				     dst->env_ipc_dstva + i * PGSIZE, perm)) < 0) {
+			while (i-- > 0)
+				page_remove(dst->env_pgdir, 
+					    dst->env_ipc_dstva + i * PGSIZE);
+			return r;
+		}
+	dst->env_ipc_perm = perm;
+	dst->env_ipc_npages = npages;
+	return 0;
+}
+
+// Send a message from curenv to dst, as described for sys_ipc_try_send.
+//
+// Returns 1 if the message was delivered to dst and dst made runnable,
+// 0 if it was queued, < 0 on error (the errors of sys_ipc_try_send).
+static int
+ipc_deliver(struct Env *dst, uint32_t value, void *srcva, unsigned perm)
+{
+	int r;
+	unsigned i, npages = 0;
+	struct Page *pp[IPC_MAXPAGES], *list = NULL;
+	struct Ipcmsg *msg;
+
+	if (!ipc_recving_from(dst, curenv) && (dst->env_ipc_qcount == IPCQSIZE))
+		// not currently blocked and no room to queue the message
+		return -E_IPC_NOT_RECV;
+
+	if (srcva < (void *) UTOP) {
+		// srcva is a page, or IPC_NPAGES(va, n) for n pages
+		npages = PGOFF(srcva) + 1;
+		srcva = ROUNDDOWN(srcva, PGSIZE);
+		if (npages > IPC_MAXPAGES || srcva + npages * PGSIZE > (void *) UTOP)
+			return -E_INVAL;
+
+		// check that permissions are appropriate
+		if (!(perm & PTE_U) || !(perm & PTE_P) || (perm & ~PTE_USER))
+			return -E_INVAL;
+
+		for (i = 0; i < npages; i++)
+			if ((r = ipc_lookup_page(srcva + i * PGSIZE, perm, 
+						 &pp[i])) < 0)
+				return r;
+	}
+
+	if (!ipc_recving_from(dst, curenv)) {
+		// Several pages are listed in a page of their own.
+		if (npages > 1) {
+			if ((r = page_alloc(&list)) < 0)
+				return r;
+			list->pp_ref++;
+			memmove(page2kva(list), pp, npages * sizeof(pp[0]));
+		}
+
+		// Queue the message for the target's next sys_ipc_recv.
+		msg = &dst->env_ipc_queue[(dst->env_ipc_qhead + dst->env_ipc_qcount) 
+			% IPCQSIZE];
+		msg->im_from = curenv->env_id;
+		msg->im_value = value;
+		msg->im_page = list ? list : (npages ? pp[0] : NULL);
+		msg->im_npages = npages;
+		msg->im_perm = npages ? perm : 0;
+		for (i = 0; i < npages; i++)
+			++pp[i]->pp_ref;
+		dst->env_ipc_qcount++;
+		return 0;
+	}
+
+	if ((r = ipc_map_pages(dst, pp, npages, perm)) < 0)
+		return r;
+	ipc_finish(dst, value);
+	return 1;
+}
+
+// Check a dstva argument for receiving: >= UTOP for no page, or a
+// page-aligned va or IPC_NPAGES(va, n) with all n pages below UTOP.
+static int
+ipc_check_dstva(void *dstva)
+{
+	uintptr_t va = ROUNDDOWN((uintptr_t) dstva, PGSIZE);
+	unsigned npages = PGOFF(dstva) + 1;
+
+	if (dstva >= (void *) UTOP)
+		return 0;
+	if (npages > IPC_MAXPAGES || va + npages * PGSIZE > UTOP)
+		return -E_INVAL;
+	return 0;
+}
+
+// Set curenv's env_ipc_dstva and env_ipc_maxpages from 'dstva', which
+// ipc_check_dstva has approved.
+static void
+ipc_set_dstva(void *dstva)
+{
+	if (dstva < (void *) UTOP) {
+		curenv->env_ipc_dstva = ROUNDDOWN(dstva, PGSIZE);
+		curenv->env_ipc_maxpages = PGOFF(dstva) + 1;
+	} else {
+		curenv->env_ipc_dstva = NULL;
+		curenv->env_ipc_maxpages = 0;
+	}
+}
+
+// Mark curenv as blocked waiting for a message from 'from', or from anyone
+// if 'from' is 0, to be received at 'dstva'. The caller then gives up the 
+// CPU; the pending system call returns 0 once the message is delivered.
+static void
+ipc_block(void *dstva, envid_t from)
+{
+	ipc_set_dstva(dstva);
+
+	// Update fields of the current environment.
+	curenv->env_ipc_recving = 1;
+	curenv->env_ipc_waitfrom = from;
+	curenv->env_ipc_from = 0;
+  curenv->env_ipc_value = 0;
+  curenv->env_ipc_perm = 0;	
+	curenv->env_ipc_npages = 0;
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	curenv->env_tf.tf_regs.reg_eax = 0;
+
+	// Environments that block waiting for messages are interactive,
+	// so give them back their base priority level.
+	sched_setlevel(curenv, curenv->env_prio);
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
-// so that receiver gets a duplicate mapping of the same page.
+// so that receiver gets a duplicate mapping of the same page.  If srcva
+// is IPC_NPAGES(va, n), send the n pages mapped from va on, to a target
+// that receives up to at least n pages.
 //
-// The send fails with a return value of -E_IPC_NOT_RECV if the
-// target is not blocked, waiting for an IPC.
+// If the target is blocked, waiting for an IPC, the message is delivered
+// right away. Otherwise it is appended to the target's message queue, 
+// holding references to the pages if there are any, and delivered when the 
+// target next calls sys_ipc_recv. Either way the sender doesn't wait.
+// The send fails with a return value of -E_IPC_NOT_RECV only if the 
+// target is not blocked and its queue is full.
 //
 // The send also can fail for the other reasons listed below.
 //
-// Otherwise, the send succeeds, and the target's ipc fields are
-// updated as follows:
+// Otherwise, the send succeeds, and when the message is delivered the 
+// target's ipc fields are updated as follows:
 //    env_ipc_recving is set to 0 to block future sends;
 //    env_ipc_from is set to the sending envid;
 //    env_ipc_value is set to the 'value' parameter;
 //    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise.
-// The target environment is marked runnable again, returning 0
+//    env_ipc_npages is set to the number of pages transferred.
+// A blocked target is marked runnable again, returning 0
 // from the paused sys_ipc_recv system call.  (Hint: does the
 // sys_ipc_recv function ever actually return?)
 //
@@ -358,9 +762,12 @@ sys_page_unmap(envid_t envid, void *va)
 // Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist.
 //		(No need to check permissions.)
-//	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
-//		or another environment managed to send first.
-//	-E_INVAL if srcva < UTOP but srcva is not page-aligned.
+//	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv
+//		and has IPCQSIZE messages queued already.
+//	-E_INVAL if srcva < UTOP but is neither page-aligned nor
+//		IPC_NPAGES(va, n) for n <= IPC_MAXPAGES pages below UTOP.
+//	-E_INVAL if several pages are sent but envid, blocked receiving,
+//		accepts fewer.
 //	-E_INVAL if srcva < UTOP and perm is inappropriate
 //		(see sys_page_alloc).
 //	-E_INVAL if srcva < UTOP but srcva is not mapped in the caller's
@@ -368,58 +775,66 @@ sys_page_unmap(envid_t envid, void *va)
 //	-E_INVAL if (perm & PTE_W), but srcva is read-only in the
 //		current environment's address space.
 //	-E_NO_MEM if there's not enough memory to map srcva in envid's
-//		address space.
+//		address space, or to queue several pages.
 static int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 {
 	int r;
 	struct Env *dst = NULL;
-	struct Page *pp = NULL;
-	pte_t *pte = NULL;
 
 	if ((r = envid2env(envid, &dst, 0)) < 0)
 		// target environment doesn't currently exist
 		return r;
 
-	if (!dst->env_ipc_recving || (dst->env_ipc_from != 0))
-		// not currently blocked or another env managed to send first
-		return -E_IPC_NOT_RECV;
-
-	if ((srcva < (void *) UTOP) && (PGOFF(srcva) != 0))
-		// srcva < UTOP but srcva is not page-aligned
-		return -E_INVAL;
+	if ((r = ipc_deliver(dst, value, srcva, perm)) < 0)
+		return r;
+	return 0;
+}
 
-	if (srcva < (void *) UTOP) {
-		// check that permissions are appropriate
-		if (!(perm & PTE_U) || !(perm & PTE_P) || (perm & ~PTE_USER))
-			return -E_INVAL;
-	}
+// Send 'value' and the 'npages' pages mapped at srcvas[0], ...,
+// srcvas[npages-1] to 'envid', with permission 'perm', mapping them one
+// after another from the dstva it is receiving at.  So that a server
+// can hand several pages to a client at once, without copying them.
+// Unlike sys_ipc_try_send, this never queues the message: 'envid' must
+// be blocked receiving, from the current environment or from anyone, 
+// with room for npages pages (see IPC_NPAGES).  On delivery it learns 
+// the number of pages from env_ipc_npages.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_IPC_NOT_RECV if envid is not blocked receiving from us.
+//	-E_INVAL if envid accepts fewer than npages pages.
+//	-E_INVAL if perm is inappropriate (see sys_page_alloc).
+//	-E_INVAL if some srcvas[i] is >= UTOP, not page-aligned, or not
+//		mapped, or read-only while perm has PTE_W.
+//	-E_NO_MEM if there's not enough memory to map the pages.
+static int
+sys_ipc_send_pages(envid_t envid, uint32_t value, void **srcvas, 
+		   unsigned npages, unsigned perm)
+{
+	int r;
+	unsigned i;
+	struct Env *dst;
+	struct Page *pp[IPC_MAXPAGES];
 
-	if ((srcva < (void *) UTOP) && 
-			((pp = page_lookup(curenv->env_pgdir, srcva, &pte)) == NULL))
-		// page not mapped in the caller's address space.
+	if ((r = envid2env(envid, &dst, 0)) < 0)
+		return r;
+	if (!ipc_recving_from(dst, curenv))
+		return -E_IPC_NOT_RECV;
+	if (npages > 0 && (!dst->env_ipc_dstva || npages > dst->env_ipc_maxpages))
 		return -E_INVAL;
-
-	if ((srcva < (void *) UTOP) && !(*pte & PTE_W) && (perm & PTE_W))
-		// srcva is read-only in the current environment's address space.
+	if (npages > 0 && 
+	    (!(perm & PTE_U) || !(perm & PTE_P) || (perm & ~PTE_USER)))
 		return -E_INVAL;
 
-	if ((srcva < (void *) UTOP) && (dst->env_ipc_dstva)) {
-		// send a page
-		if ((r = page_insert(dst->env_pgdir, pp, dst->env_ipc_dstva, perm)) < 0)
+	user_mem_assert(curenv, srcvas, npages * sizeof(void *), PTE_P|PTE_U);
+	for (i = 0; i < npages; i++)
+		if ((r = ipc_lookup_page(srcvas[i], perm, &pp[i])) < 0)
 			return r;
-		dst->env_ipc_perm = perm;
-	} else {
-		dst->env_ipc_perm = 0;
-	}
-
-	// Deliver the message.
-	dst->env_ipc_recving = 0; // block future requests
-	dst->env_ipc_from = curenv->env_id;
-	dst->env_ipc_value = value;
-	dst->env_tf.tf_regs.reg_eax = 0;
-	dst->env_status = ENV_RUNNABLE;
 
+	if ((r = ipc_map_pages(dst, pp, npages, perm)) < 0)
+		return r;
+	ipc_finish(dst, value);
 	return 0;
 }
 
@@ -427,40 +842,149 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
 //
+// If messages were queued while we weren't receiving, the oldest one is
+// delivered right away instead, without giving up the CPU.
+//
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
-// 'dstva' is the virtual address at which the sent page should be mapped.
+// 'dstva' is the virtual address at which the sent page should be mapped,
+// or IPC_NPAGES(va, n) to accept up to n pages at va.  Pages of a queued
+// message that don't fit are dropped.
 //
-// This function only returns on error, but the system call will eventually
-// return 0 on success.
+// This function only returns on error or when a queued message is 
+// delivered, but the system call will eventually return 0 on success.
 // Return < 0 on error.  Errors are:
-//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP but isn't a page-aligned va or
+//		IPC_NPAGES(va, n) with n <= IPC_MAXPAGES pages below UTOP.
+//	-E_NO_MEM if there's not enough memory to map the pages of a queued
+//		message at dstva. The message stays queued.
+//	-E_TIMEOUT if 'msec' is nonzero and no message arrived before
+//		time_msec() reached it.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv_until(void *dstva, unsigned msec)
 {
-	// If setting up shared page mapping, dstva must be page-aligned.
-	if ((dstva < (void *) UTOP) && (PGOFF(dstva) != 0))
-		return -E_INVAL;
+	int r;
+	struct Ipcmsg *msg;
+
+	if ((r = ipc_check_dstva(dstva)) < 0)
+		return r;
 
-	if (dstva < (void *) UTOP)
-    curenv->env_ipc_dstva = dstva;
-  else
-    curenv->env_ipc_dstva = NULL;
+	if (curenv->env_ipc_qcount > 0) {
+		// Take the oldest queued message.
+		msg = &curenv->env_ipc_queue[curenv->env_ipc_qhead];
+		ipc_set_dstva(dstva);
+		if ((r = ipc_map_pages(curenv, env_ipc_msg_pages(msg),
+				MIN(msg->im_npages, curenv->env_ipc_maxpages),
+				msg->im_perm)) < 0)
+			return r;
+		env_ipc_msg_drop(msg);
+
+		curenv->env_ipc_recving = 0;
+		curenv->env_ipc_from = msg->im_from;
+		curenv->env_ipc_value = msg->im_value;
+		curenv->env_ipc_qhead = (curenv->env_ipc_qhead + 1) % IPCQSIZE;
+		curenv->env_ipc_qcount--;
+		return 0;
+	}
 
-	// Update fields of the current environment.
-	curenv->env_ipc_recving = 1;
-	curenv->env_ipc_from = 0;
-  curenv->env_ipc_value = 0;
-  curenv->env_ipc_perm = 0;	
-	curenv->env_status = ENV_NOT_RUNNABLE;
+	if (msec && (time_msec() >= msec))
+		return -E_TIMEOUT;
+
+	ipc_block(dstva, 0);
+	if (msec)
+		time_wakeup_at(curenv, msec);
 
 	// Give up the CPU.
-	curenv->env_tf.tf_regs.reg_eax = 0;
 	sched_yield();
 	
 	// Success!
 	return 0;
 }
 
+// sys_ipc_recv_until with no timeout.
+static int
+sys_ipc_recv(void *dstva)
+{
+	return sys_ipc_recv_until(dstva, 0);
+}
+
+// Block until time_msec() reaches 'msec'. Returns 0 right away if it
+// already has.
+static int
+sys_sleep_until(unsigned msec)
+{
+	if (time_msec() >= msec)
+		return 0;
+
+	time_wakeup_at(curenv, msec);
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	sched_yield();
+}
+
+// Send a request to 'envid' like sys_ipc_try_send, and block until 'envid'
+// replies, like sys_ipc_recv but only accepting a message from 'envid'.
+// If the request could be delivered right away, 'envid' was blocked 
+// waiting for it, so we switch straight to it instead of going through 
+// the scheduler. A server answering with sys_ipc_reply_wait switches 
+// straight back, so a round trip takes two kernel crossings.
+//
+// The system call returns 0 once the reply has been received.
+// Return < 0 on error, in which case the request was not sent.  Errors are
+// those of sys_ipc_try_send, and those of sys_ipc_recv for dstva.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm, 
+	void *dstva)
+{
+	int r;
+	struct Env *dst;
+
+	if ((r = ipc_check_dstva(dstva)) < 0)
+		return r;
+
+	if ((r = envid2env(envid, &dst, 0)) < 0)
+		return r;
+	if ((r = ipc_deliver(dst, value, srcva, perm)) < 0)
+		return r;
+
+	ipc_block(dstva, dst->env_id);
+	if (r > 0)
+		env_run(dst);
+	sched_yield();
+}
+
+// Reply to 'envid' like sys_ipc_try_send, then receive the next request 
+// like sys_ipc_recv. If 'envid' is 0 there is no reply to send.
+// If a request is already queued it is received right away. Otherwise
+// we block and, if the reply could be delivered, switch straight to the 
+// environment we replied to, which is typically blocked in sys_ipc_call.
+// A reply to an environment that no longer exists is dropped.
+//
+// The system call returns 0 once the next request has been received.
+// Return < 0 on error, in which case the reply was not sent.  Errors are
+// those of sys_ipc_try_send, and those of sys_ipc_recv for dstva.
+static int
+sys_ipc_reply_wait(envid_t envid, uint32_t value, void *srcva, unsigned perm, 
+	void *dstva)
+{
+	int r = 0;
+	struct Env *dst = NULL;
+
+	if ((r = ipc_check_dstva(dstva)) < 0)
+		return r;
+
+	if (envid && (envid2env(envid, &dst, 0) == 0) &&
+			((r = ipc_deliver(dst, value, srcva, perm)) < 0))
+		return r;
+
+	if (curenv->env_ipc_qcount > 0)
+		return sys_ipc_recv(dstva);
+
+	ipc_block(dstva, 0);
+	if (r > 0)
+		env_run(dst);
+	sched_yield();
+}
+
 // Return the current time.
 static int
 sys_time_msec(void) 
@@ -471,16 +995,277 @@ sys_time_msec(void)
 // Transmit a packet with the E100 nic.
 static int
 sys_xmit_frame(const char *data, uint16_t len) {
+	if (len > ETH_FRAME_LEN)
+		return -E_INVAL;
+	user_mem_assert(curenv, data, len, PTE_P);
+	return e100_xmit_frame(data, len);
+}
+
+// Put the current environment to sleep until the E100 frees a CB, and 
+// restart the system call that found the CBL full once it wakes up.
+// Returns only on error: -E_NO_MEM if too many environments are waiting
+// already.
+static int
+xmit_block(void)
+{
+	int r;
+
+	if ((r = e100_tx_sleep(curenv)) < 0)
+		return r;
+	curenv->env_tf.tf_eip -= 2; // sizeof 'int $T_SYSCALL'
+	sched_yield();
+}
+
+// Transmit a packet with the E100 nic like sys_xmit_frame, but if the 
+// transmit DMA ring is full block until the E100 has sent enough frames 
+// to make room for it instead of dropping it.
+// Returns -E_INVAL if the frame is longer than ETH_FRAME_LEN, or 
+// -E_NO_MEM if too many environments are blocked already.
+static int
+sys_xmit_wait(const char *data, uint16_t len) {
+	int r;
+
+	if (len > ETH_FRAME_LEN)
+		return -E_INVAL;
 	user_mem_assert(curenv, data, len, PTE_P);
+
+	e100_tx_clean();
+	if (e100.cbs_avail == 0 && (r = xmit_block()) < 0)
+		return r;
 	return e100_xmit_frame(data, len);
 }
 
+// Transmit a packet gathered from the fragments described by 'sg' with
+// the E100 nic, without copying it. Each fragment is split at page 
+// boundaries into TBDs and its pages are kept alive until the frame has
+// been sent. On success the frame's sequence number and the number of 
+// frames sent so far are stored in sg->sg_seq and sg->sg_done.
+// If the transmit DMA ring is full, blocks like sys_xmit_wait. This 
+// pushes back on the caller rather than dropping frames under load.
+// With no fragments, nothing is sent; only sg->sg_done is updated, so
+// the caller can find out which of its frames are done.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if the number of fragments is out of range, the frame
+//		is longer than ETH_FRAME_LEN or needs too many TBDs.
+//	-E_NO_MEM if the ring is full and too many environments are
+//		blocked on it already.
+static int
+sys_xmit_frags(struct jif_sg *sg) {
+	int i, r, n = 0, len, chunk, total = 0;
+	uintptr_t va;
+	struct tbd tbds[E100_MAXTBDS];
+	struct Page *pages[E100_MAXTBDS];
+
+	user_mem_assert(curenv, sg, sizeof(struct jif_sg), PTE_P|PTE_W);
+	if ((sg->sg_nfrags < 0) || (sg->sg_nfrags > JIF_SG_MAXFRAGS))
+		return -E_INVAL;
+
+	e100_tx_clean();
+	if (sg->sg_nfrags == 0) {
+		sg->sg_done = e100.tx_done;
+		return 0;
+	}
+	if (e100.cbs_avail == 0 && (r = xmit_block()) < 0)
+		return r;
+
+	for (i = 0; i < sg->sg_nfrags; i++) {
+		va = (uintptr_t) sg->sg_frags[i].jf_va;
+		len = sg->sg_frags[i].jf_len;
+		if ((len < 0) || ((total += len) > ETH_FRAME_LEN))
+			return -E_INVAL;
+		user_mem_assert(curenv, (void *) va, len, PTE_P);
+
+		// The CU can only gather physically contiguous 
+		// buffers, so split the fragment at page boundaries.
+		for (; len > 0; va += chunk, len -= chunk) {
+			if (n == E100_MAXTBDS)
+				return -E_INVAL;
+			chunk = MIN(len, PGSIZE - PGOFF(va));
+			pages[n] = page_lookup(curenv->env_pgdir, (void *) va, NULL);
+			tbds[n].addr = page2pa(pages[n]) + PGOFF(va);
+			tbds[n].size = chunk;
+			tbds[n].eol = 0;
+			n++;
+		}
+	}
+	if (n == 0)
+		return -E_INVAL;
+
+	// Hold on to the pages while the CU may still read them.
+	for (i = 0; i < n; i++)
+		++pages[i]->pp_ref;
+
+	if ((r = e100_xmit_sg(tbds, pages, n, &sg->sg_seq)) < 0) {
+		for (i = 0; i < n; i++)
+			page_decref(pages[i]);
+		return r;
+	}
+
+	sg->sg_done = e100.tx_done;
+	return 0;
+}
+
 // Transmit a packet with the E100 nic.
 static int
 sys_rx(char *data) {
 	return e100_rx(data);
 }
 
+// Receive a packet with the E100 nic, blocking until one arrives.
+//
+// If the RFA is empty the environment is marked not runnable until the 
+// E100 raises a frame received interrupt. Its instruction pointer is 
+// backed up over the 'int $T_SYSCALL' instruction, so once it is woken 
+// up the system call is simply restarted and picks up the new frame.
+//
+// Returns the length of the frame on success, < 0 on error.
+static int
+sys_rx_wait(char *data) {
+	int r;
+
+	user_mem_assert(curenv, data, ETH_FRAME_LEN, PTE_P|PTE_W);
+	if ((r = e100_rx(data)) != -E_RFA_EMPTY)
+		return r;
+
+	e100_rx_sleep(curenv);
+	curenv->env_tf.tf_eip -= 2; // sizeof 'int $T_SYSCALL'
+	sched_yield();
+}
+
+// Receive a burst of up to 'max' packets with the E100 nic into the page 
+// at 'va', packed as an array of struct jif_pkt records (see inc/ns.h).
+// Blocks like sys_rx_wait until at least one packet is available.
+//
+// Returns the number of packets received on success, < 0 on error.  
+// Errors are:
+//	-E_INVAL if va is not page-aligned or max is not positive.
+static int
+sys_rx_batch(void *va, int max) {
+	int r;
+
+	if ((PGOFF(va) != 0) || (max <= 0))
+		return -E_INVAL;
+
+	user_mem_assert(curenv, va, PGSIZE, PTE_P|PTE_W);
+	if ((r = e100_rx_batch(va, PGSIZE, max)) != -E_RFA_EMPTY)
+		return r;
+
+	e100_rx_sleep(curenv);
+	curenv->env_tf.tf_eip -= 2; // sizeof 'int $T_SYSCALL'
+	sched_yield();
+}
+
+// Receive a packet with the E100 nic without copying it: the page the 
+// packet was received into is mapped at 'dstva' in the current environment
+// and a fresh page takes its place in the receive DMA ring. The packet is 
+// a struct jif_pkt at offset JIF_RFD_PKTOFF of the page (see inc/ns.h).
+// Blocks like sys_rx_wait until a packet is available.
+//
+// Returns the length of the packet on success, < 0 on error.  Errors are:
+//	-E_INVAL if dstva >= UTOP, or dstva is not page-aligned.
+//	-E_NO_MEM if there's no memory to allocate a replacement page,
+//		or to allocate any necessary page tables.
+static int
+sys_rx_map(void *dstva) {
+	int r;
+	struct Page *pp = NULL;
+
+	if ((dstva >= (void *) UTOP) || (PGOFF(dstva) != 0))
+		return -E_INVAL;
+
+	// Make sure the page table exists up front, so that once the 
+	// page is taken out of the ring page_insert can't fail.
+	if (!pgdir_walk(curenv->env_pgdir, dstva, 1))
+		return -E_NO_MEM;
+
+	if ((r = e100_rx_flip(&pp)) == -E_RFA_EMPTY) {
+		e100_rx_sleep(curenv);
+		curenv->env_tf.tf_eip -= 2; // sizeof 'int $T_SYSCALL'
+		sched_yield();
+	}
+	if (r < 0)
+		return r;
+
+	page_insert(curenv->env_pgdir, pp, dstva, PTE_P|PTE_U|PTE_W);
+	page_decref(pp);
+	return r;
+}
+
+// Have received packets copied straight into 'ring', a struct jif_ring 
+// in the current environment's address space, instead of fetching them 
+// with sys_rx and friends. The kernel is the ring's producer.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if ring is not page-aligned.
+static int
+sys_rx_ring(struct jif_ring *ring) {
+	int i;
+	struct Page *pages[JIF_RING_PAGES];
+
+	if (PGOFF(ring) != 0)
+		return -E_INVAL;
+	user_mem_assert(curenv, ring, sizeof(struct jif_ring), PTE_P|PTE_W);
+
+	for (i = 0; i < JIF_RING_PAGES; i++)
+		pages[i] = page_lookup(curenv->env_pgdir, 
+				(char *) ring + i * PGSIZE, NULL);
+	e100_rx_ring_attach(curenv, pages);
+
+	// Hand over any frames that arrived before the ring.
+	e100_rx_ring_fill();
+	return 0;
+}
+
+// Block until the producer of 'ring' makes it non-empty, if the caller
+// is the ring's consumer and has set ring->jr_waiting, which tells the
+// producer to call sys_ring_notify once it adds a packet.  Or block
+// until the consumer makes room in it, if the caller is the producer
+// and has set ring->jr_prodwait.  Returns at once if the ring is neither
+// empty nor full any more, or if the flag has been cleared.
+//
+// Always returns 0; the caller must check the ring again on return.
+static int
+sys_ring_wait(struct jif_ring *ring) {
+	user_mem_assert(curenv, ring, sizeof(ring->jr_head) * 4, PTE_P);
+
+	// The receive ring is filled by the kernel, so it's our job 
+	// to top it up from the RFA once the consumer has made room.
+	if (curenv->env_id == e100.rx_ring_env)
+		e100_rx_ring_fill();
+
+	if (!(ring->jr_head == ring->jr_tail && ring->jr_waiting)
+	    && !(ring->jr_head - ring->jr_tail == JIF_RING_NSLOTS
+		 && ring->jr_prodwait))
+		return 0;
+
+	curenv->env_ring_waiting = 1;
+	env_set_status(curenv, ENV_NOT_RUNNABLE);
+	curenv->env_tf.tf_regs.reg_eax = 0;
+	sched_yield();
+}
+
+// Ring the doorbell of environment envid: wake it up if it's blocked 
+// in sys_ring_wait. Any environment may ring any doorbell, since a 
+// spurious wakeup only makes the consumer look at its ring again.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_ring_notify(envid_t envid) {
+	int r;
+	struct Env *e;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+
+	if (e->env_ring_waiting) {
+		e->env_ring_waiting = 0;
+		env_set_status(e, ENV_RUNNABLE);
+	}
+	return 0;
+}
+
 // Dispatches to the correct kernel function, passing the arguments.
 int32_t
 syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
@@ -504,27 +1289,69 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		case SYS_env_set_status:
 			return sys_env_set_status((envid_t) a1, (int) a2);
 
+		case SYS_env_set_priority:
+			return sys_env_set_priority((envid_t) a1, (int) a2);
+
+		case SYS_env_stat:
+			return sys_env_stat((envid_t) a1, (struct Envstat *) a2);
+
 		case SYS_exofork:
 			return sys_exofork();
 
+		case SYS_fork:
+			return sys_fork();
+
 		case SYS_getenvid:
 			return sys_getenvid();
 
 		case SYS_ipc_try_send:
 			return sys_ipc_try_send((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4);
 
+		case SYS_ipc_send_pages:
+			return sys_ipc_send_pages((envid_t) a1, (uint32_t) a2, (void **) a3, (unsigned) a4, (unsigned) a5);
+
 		case SYS_ipc_recv:
 			return sys_ipc_recv((void *) a1);
 
+		case SYS_ipc_recv_until:
+			return sys_ipc_recv_until((void *) a1, (unsigned) a2);
+
+		case SYS_ipc_call:
+			return sys_ipc_call((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4, (void *) a5);
+
+		case SYS_ipc_reply_wait:
+			return sys_ipc_reply_wait((envid_t) a1, (uint32_t) a2, (void *) a3, (unsigned) a4, (void *) a5);
+
 		case SYS_xmit_frame:
 			return sys_xmit_frame((const char *) a1, (uint16_t) a2);
 
+		case SYS_xmit_frags:
+			return sys_xmit_frags((struct jif_sg *) a1);
+
+		case SYS_xmit_wait:
+			return sys_xmit_wait((const char *) a1, (uint16_t) a2);
+
+		case SYS_rx_ring:
+			return sys_rx_ring((struct jif_ring *) a1);
+
+		case SYS_ring_wait:
+			return sys_ring_wait((struct jif_ring *) a1);
+
+		case SYS_ring_notify:
+			return sys_ring_notify((envid_t) a1);
+
 		case SYS_page_alloc:
 			return sys_page_alloc((envid_t) a1, (void *) a2, (int) a3);
 
+		case SYS_page_alloc_super:
+			return sys_page_alloc_super((envid_t) a1, (void *) a2, (int) a3);
+
 		case SYS_page_map:       	
 			return sys_page_map((envid_t) a1, (void *) a2, (envid_t) a3, (void *) a4, (int) a5);
 
+		case SYS_page_batch:
+			return sys_page_batch((envid_t) a1, (envid_t) a2, (struct Pageop *) a3, (unsigned) a4);
+
 		case SYS_page_unmap:     	
 			return sys_page_unmap((envid_t) a1, (void *) a2);
 
@@ -534,9 +1361,21 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		case SYS_time_msec:
 			return sys_time_msec();
 
+		case SYS_sleep_until:
+			return sys_sleep_until((unsigned) a1);
+
 		case SYS_rx:
 			return sys_rx((char *) a1);
 
+		case SYS_rx_wait:
+			return sys_rx_wait((char *) a1);
+
+		case SYS_rx_batch:
+			return sys_rx_batch((void *) a1, (int) a2);
+
+		case SYS_rx_map:
+			return sys_rx_map((void *) a1);
+
 		case SYS_yield:
 			sys_yield();
 			return 0;
@@ -1,26 +1,193 @@
 #include <kern/time.h>
+#include <kern/env.h>
+#include <kern/kclock.h>
+#include <kern/cmdline.h>
 #include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/stdio.h>
+#include <inc/timerreg.h>
 
 static unsigned int ticks;
+static unsigned int tick_hz;		// timer interrupts per second
+static uint64_t tick_nsec;		// length of a tick
+static bool tickless;			// stop the tick while idle?
+static bool idling;			// is the tick stopped right now?
 
+// The clock as user environments see it, at UTIME.
+struct Timepage *timepage;
+
+// Hashed timer wheel. An environment sleeping until tick t hangs off
+// slot t % TW_NSLOTS; each tick only that one slot is scanned, and
+// entries due in a later turn of the wheel are left where they are.
+#define TW_NSLOTS	64
+static LIST_HEAD(Timer_list, Env) timer_wheel[TW_NSLOTS];
+static int ntimers;			// environments on the wheel
+
+// Boot parameters:
+//	timer.hz=N	  take N timer interrupts a second (default 100)
+//	timer.tickless=1  stop the timer interrupt while nothing is runnable,
+//			  waking only for the next timeout
 void
-time_init(void) 
+time_init(void)
 {
+	int i;
+
 	ticks = 0;
+	for (i = 0; i < TW_NSLOTS; i++)
+		LIST_INIT(&timer_wheel[i]);
+
+	tick_hz = cmdline_int("timer.hz", 100);
+	tick_hz = MIN(MAX(tick_hz, TIMER_FREQ / 0xffff + 1), 10000);
+	tick_nsec = 1000000000 / tick_hz;
+
+	timepage->tp_msec = 0;
+	timepage->tp_tsc_khz = kclock_tsc_khz();
+	timepage->tp_tsc_boot = read_tsc();
+	cprintf("TSC runs at %u kHz\n", timepage->tp_tsc_khz);
+
+	// Without a TSC there's no telling how long we were idle.
+	tickless = cmdline_int("timer.tickless", 0) && timepage->tp_tsc_khz;
+
+	kclock_init(tick_hz);
+}
+
+// Wake environments whose timers expired at or before tick 'now'.
+static void
+time_expire(unsigned int now)
+{
+	struct Env *e, *next;
+
+	for (e = LIST_FIRST(&timer_wheel[now % TW_NSLOTS]); e; e = next) {
+		next = LIST_NEXT(e, env_timerlink);
+		if (e->env_timeout > now)
+			continue;
+		time_cancel(e);
+		if (e->env_ipc_recving) {
+			// sys_ipc_recv_until ran out of time
+			e->env_ipc_recving = 0;
+			e->env_ipc_waitfrom = 0;
+			e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+		}
+		env_set_status(e, ENV_RUNNABLE);
+	}
 }
 
 // This should be called once per timer interrupt.  A timer interrupt
-// fires every 10 ms.
+// fires every tick, except in tickless mode while idle, so in tickless
+// mode the tick count is caught up from the TSC.
 void
-time_tick(void) 
+time_tick(void)
 {
-	ticks++;
-	if (ticks * 10 < ticks)
+	unsigned int now, n;
+	uint64_t msec;
+
+	now = ticks + 1;
+	if (tickless)
+		now = MAX(now, time_nsec() / tick_nsec);
+	msec = (uint64_t) now * 1000 / tick_hz;
+	if (msec > ~(uint32_t) 0)
 		panic("time_tick: time overflowed");
+
+	// Visit every slot passed over, but each slot only once.
+	for (n = 0; n < MIN(now - ticks, TW_NSLOTS); n++)
+		time_expire(now - n);
+	ticks = now;
+	timepage->tp_msec = msec;
+}
+
+// Timer interrupts per second.
+unsigned int
+time_hz(void)
+{
+	return tick_hz;
 }
 
 unsigned int
-time_msec(void) 
+time_msec(void)
+{
+	return timepage->tp_msec;
+}
+
+// Nanoseconds since time_init, as precise as the TSC allows.
+uint64_t
+time_nsec(void)
+{
+	return timepage_nsec(timepage);
+}
+
+// Arrange for e to be made runnable once time_msec() reaches msec.
+// The caller blocks e; a wakeup by any other means must cancel the timer.
+void
+time_wakeup_at(struct Env *e, unsigned int msec)
+{
+	uint64_t t = ((uint64_t) msec * tick_hz + 999) / 1000;
+
+	time_cancel(e);
+	e->env_timeout = MAX(t, ticks + 1);
+	LIST_INSERT_HEAD(&timer_wheel[e->env_timeout % TW_NSLOTS], e,
+		env_timerlink);
+	ntimers++;
+}
+
+// Disarm e's timer, if it has one.
+void
+time_cancel(struct Env *e)
+{
+	if (!e->env_timeout)
+		return;
+	LIST_REMOVE(e, env_timerlink);
+	e->env_timeout = 0;
+	ntimers--;
+}
+
+// Is the periodic tick stopped while nothing is runnable?
+bool
+time_tickless(void)
+{
+	return tickless;
+}
+
+// Nothing is runnable. In tickless mode, stop the periodic tick and
+// program a single timer interrupt for the earliest pending timeout,
+// or none at all if there is none, and return 1; the caller then halts
+// until an interrupt arrives. Returns 0 if the tick keeps running.
+bool
+time_idle(void)
+{
+	int i;
+	struct Env *e;
+	unsigned int now, next = 0;
+	uint64_t count;
+
+	if (!tickless)
+		return 0;
+	now = MAX(ticks, time_nsec() / tick_nsec);
+
+	for (i = 0; ntimers > 0 && i < TW_NSLOTS; i++)
+		LIST_FOREACH(e, &timer_wheel[i], env_timerlink)
+			if (!next || e->env_timeout < next)
+				next = e->env_timeout;
+
+	idling = 1;
+	if (!next)
+		kclock_stop();
+	else {
+		// The 8253 can't count past 0xffff, so a distant timeout
+		// costs a few spurious wakeups.
+		count = (uint64_t) (next - MIN(next - 1, now)) *
+			TIMER_DIV(tick_hz);
+		kclock_oneshot(MIN(count, 0xffff));
+	}
+	return 1;
+}
+
+// Something is runnable again; restart the periodic tick if time_idle
+// stopped it.
+void
+time_resume(void)
 {
-	return ticks * 10;
+	if (!idling)
+		return;
+	idling = 0;
+	kclock_periodic(tick_hz);
 }
@@ -4,8 +4,21 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/time.h>
+
+extern struct Timepage *timepage;
+
 void time_init(void);
 void time_tick(void); 
 unsigned int time_msec(void);
+unsigned int time_hz(void);
+uint64_t time_nsec(void);
+
+struct Env;
+void time_wakeup_at(struct Env *e, unsigned int msec);
+void time_cancel(struct Env *e);
+bool time_tickless(void);
+bool time_idle(void);
+void time_resume(void);
 
 #endif /* JOS_KERN_TIME_H */
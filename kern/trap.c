@@ -12,8 +12,9 @@
 #include <kern/kclock.h>
 #include <kern/picirq.h>
 #include <kern/time.h>
-
-static struct Taskstate ts;
+#include <kern/e100.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
 
 /* Interrupt descriptor table.  (Must be built at run time because
  * shifted function addresses can't be represented in relocation records.)
@@ -61,8 +62,6 @@ static const char *trapname(int trapno)
 void
 idt_init(void)
 {
-	extern struct Segdesc gdt[];
-	
 	// The IDT must be properly initialized with an exception 
 	// handler function for each recognized exception.
 	SETGATE(idt[T_DIVIDE],  0, GD_KT, divide_error,           0);
@@ -102,19 +101,29 @@ idt_init(void)
 	SETGATE(idt[IRQ_OFFSET+13], 0, GD_KT, irq13, 0);
 	SETGATE(idt[IRQ_OFFSET+14], 0, GD_KT, irq14, 0);
 	SETGATE(idt[IRQ_OFFSET+15], 0, GD_KT, irq15, 0);
+	SETGATE(idt[IRQ_OFFSET+IRQ_TLB], 0, GD_KT, irq_tlb, 0);
+
+	idt_init_percpu();
+}
+
+// Initialize and load the per-CPU TSS and IDT
+void
+idt_init_percpu(void)
+{
+	int i = cpunum();
 
 	// Setup a TSS so that we get the right stack
 	// when we trap to the kernel.
-	ts.ts_esp0 = KSTACKTOP;
-	ts.ts_ss0 = GD_KD;
+	thiscpu->cpu_ts.ts_esp0 = KSTACKTOP_CPU(i);
+	thiscpu->cpu_ts.ts_ss0 = GD_KD;
 
-	// Initialize the TSS field of the gdt.
-	gdt[GD_TSS >> 3] = SEG16(STS_T32A, (uint32_t) (&ts),
+	// Initialize this CPU's TSS field of the gdt.
+	gdt[(GD_TSS0 >> 3) + i] = SEG16(STS_T32A, (uint32_t) (&thiscpu->cpu_ts),
 					sizeof(struct Taskstate), 0);
-	gdt[GD_TSS >> 3].sd_s = 0;
+	gdt[(GD_TSS0 >> 3) + i].sd_s = 0;
 
 	// Load the TSS
-	ltr(GD_TSS);
+	ltr(GD_TSS0 + (i << 3));
 
 	// Load the IDT
 	asm volatile("lidt idt_pd");
@@ -165,15 +174,21 @@ trap_dispatch(struct Trapframe *tf)
 			return;
 
 		case T_SYSCALL:
+			curenv->env_stat.es_syscalls++;
 			tf->tf_regs.reg_eax = 
 				syscall(tf->tf_regs.reg_eax, tf->tf_regs.reg_edx, tf->tf_regs.reg_ecx, 
 						tf->tf_regs.reg_ebx, tf->tf_regs.reg_edi, tf->tf_regs.reg_esi);
 			return;
 
-		// Handle clock interrupts.
+		// Handle clock interrupts. The boot CPU gets the 8253's,
+		// through the 8259A, and keeps time; the other CPUs get
+		// their local APIC timers'.
 		case IRQ_OFFSET+IRQ_TIMER:
-			time_tick(); // time tick increment
-			sched_yield(); // run a different environment
+			if (thiscpu == bootcpu)
+				time_tick(); // time tick increment
+			else
+				lapic_eoi();
+			sched_tick(); // run a different environment if need be
 			return;
 
 		// Handle spurious interrupts
@@ -183,6 +198,19 @@ trap_dispatch(struct Trapframe *tf)
 			cprintf("Spurious interrupt on irq 7\n");
 			print_trapframe(tf);
 			return;
+
+		// A TLB shootdown that woke a halted CPU; see tlb_shootdown.
+		case IRQ_OFFSET+IRQ_TLB:
+			lapic_eoi();
+			tlb_shootdown_ack();
+			return;
+	}
+
+	// Handle interrupts from the E100. Its IRQ line is assigned
+	// at PCI probe time, so it can't be a case label above.
+	if (e100.io_base && trap == IRQ_OFFSET + e100.irq_line) {
+		e100_intr();
+		return;
 	}
 
 	// Unexpected trap: The user process or the kernel has a bug.
@@ -207,27 +235,60 @@ trap(struct Trapframe *tf)
 	// the interrupt path.
 	assert(!(read_eflags() & FL_IF));
 
+	// Let tlb_shootdown know this CPU is in the kernel, and answer a
+	// shootdown from user mode at once: the CPU that asked for it holds
+	// the big kernel lock and is waiting.
+	thiscpu->cpu_inkernel = 1;
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TLB && (tf->tf_cs & 3) == 3) {
+		lapic_eoi();
+		tlb_shootdown_ack();
+		thiscpu->cpu_inkernel = 0;
+		env_pop_tf(tf);
+	}
+
+	// Re-acquire the big kernel lock if we were halted in
+	// sched_halt()
+	if (xchg(&thiscpu->cpu_status, CPU_STARTED) == CPU_HALTED)
+		lock_kernel();
+
 	if ((tf->tf_cs & 3) == 3) {
 		// Trapped from user mode.
+		// Acquire the big kernel lock before doing any
+		// serious kernel work.
+		lock_kernel();
+		assert(curenv);
+
+		// Garbage collect if current environment is a zombie
+		if (curenv->env_status == ENV_DYING) {
+			env_free(curenv);
+			curenv = NULL;
+			sched_yield();
+		}
+
 		// Copy trap frame (which is currently on the stack)
 		// into 'curenv->env_tf', so that running the environment
 		// will restart at the trap point.
-		assert(curenv);
 		curenv->env_tf = *tf;
 		// The trapframe on the stack should be ignored from here on.
 		tf = &curenv->env_tf;
 	}
+
+	// A shootdown may have come in while we waited for the lock.
+	tlb_shootdown_ack();
 	
 	// Dispatch based on what type of trap occurred
 	trap_dispatch(tf);
 
 	// If we made it to this point, then no other environment was
 	// scheduled, so we should return to the current environment
-	// if doing so makes sense.
-	if (curenv && curenv->env_status == ENV_RUNNABLE)
-		env_run(curenv);
-	else
-		sched_yield();
+	// if doing so makes sense, i.e. unless the trap has woken up
+	// an environment with a higher priority.
+	if (curenv && curenv->env_status == ENV_RUNNABLE) {
+		if (!sched_preempt(curenv))
+			env_run(curenv);
+		curenv->env_preempted = 1;
+	}
+	sched_yield();
 }
 
 
@@ -13,6 +13,7 @@
 extern struct Gatedesc idt[];
 
 void idt_init(void);
+void idt_init_percpu(void);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 void page_fault_handler(struct Trapframe *);
@@ -56,5 +57,6 @@ void irq12(void);
 void irq13(void);
 void irq14(void);
 void irq15(void);
+void irq_tlb(void);
 
 #endif /* JOS_KERN_TRAP_H */
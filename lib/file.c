@@ -6,23 +6,48 @@
 
 extern union Fsipc fsipcbuf;	// page-aligned, declared in entry.S
 
+// Where the data pages of multi-page reads and writes are mapped.
+#define FSIPCPAGES	((char *) 0xCFF00000)
+
 // Send an inter-environment request to the file server, and wait for
 // a reply.  The request body should be in fsipcbuf, and parts of the
 // response may be written back to fsipcbuf.
 // type: request code, passed as the simple integer IPC value.
 // dstva: virtual address at which to receive reply page, 0 if none.
 // Returns result from the file server.
+static int fsipc_pages(unsigned type, void *srcva, void *dstva);
+
 static int
 fsipc(unsigned type, void *dstva)
+{
+	return fsipc_pages(type, &fsipcbuf, dstva);
+}
+
+// Like fsipc, but sending the request from 'srcva', which may be 
+// IPC_NPAGES(va, n) for the request page at va followed by n - 1 pages 
+// of data.
+static int
+fsipc_pages(unsigned type, void *srcva, void *dstva)
 {
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", env->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(envs[1].env_id, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	return ipc_call(envs[1].env_id, type, srcva, PTE_P | PTE_W | PTE_U,
+			dstva, NULL);
+}
+
+// Unmap the 'npages' pages at FSIPCPAGES.
+static void
+fsipc_unmap(unsigned npages)
+{
+	struct Pageop op;
+
+	op.po_op = PAGEOP_UNMAP;
+	op.po_dstva = FSIPCPAGES;
+	op.po_npages = npages;
+	sys_page_batch(0, 0, &op, 1);
 }
 
-static int devfile_flush(struct Fd *fd);
 static ssize_t devfile_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devfile_write(struct Fd *fd, const void *buf, size_t n);
 static int devfile_stat(struct Fd *fd, struct Stat *stat);
@@ -99,7 +124,7 @@ open(const char *path, int mode)
 // open, unmapping it is enough to free up server-side resources.
 // Other than that, we just have to make sure our changes are flushed
 // to disk.
-static int
+int
 devfile_flush(struct Fd *fd)
 {
 	fsipcbuf.flush.req_fileid = fd->fd_file.id;
@@ -107,6 +132,8 @@ devfile_flush(struct Fd *fd)
 }
 
 // Read at most 'n' bytes from 'fd' at the current position into 'buf'.
+// More than fits in fsipcbuf comes back in pages of their own, up to
+// FSREQ_MAXPAGES of them.
 //
 // Returns:
 // 	The number of bytes successfully read.
@@ -122,6 +149,16 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 	// system server.	
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
 	fsipcbuf.read.req_n = n;
+	if (n > sizeof(fsipcbuf.readRet.ret_buf)) {
+		n = MIN(n, FSREQ_MAXPAGES * PGSIZE);
+		fsipcbuf.read.req_n = n;
+		if ((r = fsipc(FSREQ_READ, IPC_NPAGES(FSIPCPAGES, 
+				ROUNDUP(n, PGSIZE) / PGSIZE))) < 0)
+			return r;
+		memmove(buf, FSIPCPAGES, MIN(r, env->env_ipc_npages * PGSIZE));
+		fsipc_unmap(env->env_ipc_npages);
+		return r;
+	}
 	if ((r = fsipc(FSREQ_READ, NULL)) < 0)
 		return r;
 
@@ -132,6 +169,8 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 }
 
 // Write at most 'n' bytes from 'buf' to 'fd' at the current seek position.
+// More than fits in fsipcbuf is copied into pages sent along with it, 
+// up to FSREQ_MAXPAGES of them.
 //
 // Returns:
 //	 The number of bytes successfully written.
@@ -139,6 +178,37 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 static ssize_t
 devfile_write(struct Fd *fd, const void *buf, size_t n)
 {
+	int r;
+	size_t npages;
+	struct Pageop op[2];
+
+	if (n > sizeof(fsipcbuf.write.req_buf)) {
+		// Send fsipcbuf mapped at FSIPCPAGES, followed by fresh
+		// pages holding the data.
+		npages = MIN(ROUNDUP(n, PGSIZE) / PGSIZE, FSREQ_MAXPAGES);
+		n = MIN(n, npages * PGSIZE);
+		op[0].po_op = PAGEOP_MAP;
+		op[0].po_srcva = &fsipcbuf;
+		op[0].po_dstva = FSIPCPAGES;
+		op[0].po_npages = 1;
+		op[0].po_perm = PTE_P | PTE_W | PTE_U;
+		op[1].po_op = PAGEOP_ALLOC;
+		op[1].po_dstva = FSIPCPAGES + PGSIZE;
+		op[1].po_npages = npages;
+		op[1].po_perm = PTE_P | PTE_W | PTE_U;
+		if ((r = sys_page_batch(0, 0, op, 2)) < 0) {
+			fsipc_unmap(1 + npages);
+			return r;
+		}
+		memmove(FSIPCPAGES + PGSIZE, buf, n);
+		fsipcbuf.write.req_fileid = fd->fd_file.id;
+		fsipcbuf.write.req_n = n;
+		r = fsipc_pages(FSREQ_WRITE, IPC_NPAGES(FSIPCPAGES, 1 + npages),
+				NULL);
+		fsipc_unmap(1 + npages);
+		return r;
+	}
+
 	// Make an FSREQ_WRITE request to the file system server.  Be
 	// careful: fsipcbuf.write.req_buf is only so large, but
 	// remember that write is always allowed to write *fewer*
@@ -178,6 +248,107 @@ devfile_trunc(struct Fd *fd, off_t newsize)
 	return fsipc(FSREQ_SET_SIZE, NULL);
 }
 
+// Map the file-server pages holding up to 'n' bytes of file 'fdnum',
+// starting at 'offset', read-only at 'dstva', one page after another,
+// without copying them.  'offset' and 'dstva' must be page-aligned, and
+// at most IPC_MAXPAGES pages are mapped at once.  The seek position is
+// left alone.  The pages are shared with the file server's cache, so
+// later writes to the file show through them until the server evicts
+// the blocks to make room for others; unmap them when done.
+//
+// Returns:
+//	The number of bytes mapped (0 at end of file).
+//	-E_NOT_SUPP if fdnum is not a regular file.
+//	< 0 on other errors.
+ssize_t
+read_map(int fdnum, off_t offset, void *dstva, size_t n)
+{
+	int r;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	return devfile_map(fd, offset, dstva, n, PTE_P | PTE_U);
+}
+
+// Like read_map, for the file open on 'fd', but mapping the pages with
+// permissions 'perm': PTE_P|PTE_U, optionally with PTE_SHARE.  The 
+// pages are never writable; changes to copies of them can be written 
+// back with devfile_write_back.
+ssize_t
+devfile_map(struct Fd *fd, off_t offset, void *dstva, size_t n, int perm)
+{
+	size_t npages;
+
+	if (PGOFF(dstva) != 0 || PGOFF(offset) != 0)
+		return -E_INVAL;
+
+	npages = MIN(ROUNDUP(n, PGSIZE) / PGSIZE, IPC_MAXPAGES);
+	if (npages == 0)
+		return 0;
+	fsipcbuf.read_map.req_fileid = fd->fd_file.id;
+	fsipcbuf.read_map.req_offset = offset;
+	fsipcbuf.read_map.req_n = MIN(n, npages * PGSIZE);
+	fsipcbuf.read_map.req_perm = perm;
+	return fsipc(FSREQ_READ_MAP, IPC_NPAGES(dstva, npages));
+}
+
+// Write back the 'n' bytes at 'offset' in the file open on 'fd' from
+// the pages at 'srcva', which are changed copies of the pages at
+// 'origva'.  The file server writes only the bytes that differ between
+// the two.  'offset', 'srcva' and 'origva' must be page-aligned, and
+// at most FSREQ_MAXPAGES/2 pages are written back at once.  The seek
+// position is left alone, and the file is not extended.
+//
+// Returns:
+//	The number of bytes written back.
+//	< 0 on error.
+ssize_t
+devfile_write_back(struct Fd *fd, off_t offset, void *srcva, void *origva,
+		   size_t n)
+{
+	int r;
+	size_t npages;
+	struct Pageop op[3];
+
+	if (PGOFF(srcva) != 0 || PGOFF(origva) != 0 || PGOFF(offset) != 0)
+		return -E_INVAL;
+
+	npages = MIN(ROUNDUP(n, PGSIZE) / PGSIZE, FSREQ_MAXPAGES / 2);
+	if (npages == 0)
+		return 0;
+	// Send fsipcbuf mapped at FSIPCPAGES, followed by the pages 
+	// themselves and then the originals.
+	op[0].po_op = PAGEOP_MAP;
+	op[0].po_srcva = &fsipcbuf;
+	op[0].po_dstva = FSIPCPAGES;
+	op[0].po_npages = 1;
+	op[0].po_perm = PTE_P | PTE_W | PTE_U;
+	op[1].po_op = PAGEOP_MAP;
+	op[1].po_srcva = srcva;
+	op[1].po_dstva = FSIPCPAGES + PGSIZE;
+	op[1].po_npages = npages;
+	op[1].po_perm = PTE_P | PTE_U;
+	op[2].po_op = PAGEOP_MAP;
+	op[2].po_srcva = origva;
+	op[2].po_dstva = FSIPCPAGES + (1 + npages) * PGSIZE;
+	op[2].po_npages = npages;
+	op[2].po_perm = PTE_P | PTE_U;
+	if ((r = sys_page_batch(0, 0, op, 3)) < 0) {
+		fsipc_unmap(1 + 2 * npages);
+		return r;
+	}
+	fsipcbuf.write_back.req_fileid = fd->fd_file.id;
+	fsipcbuf.write_back.req_offset = offset;
+	fsipcbuf.write_back.req_n = MIN(n, npages * PGSIZE);
+	r = fsipc_pages(FSREQ_WRITE_BACK,
+			IPC_NPAGES(FSIPCPAGES, 1 + 2 * npages), NULL);
+	fsipc_unmap(1 + 2 * npages);
+	return r;
+}
+
 // Delete a file
 int
 remove(const char *path)
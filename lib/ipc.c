@@ -21,6 +21,16 @@
 //   a perfectly valid place to map a page.)
 int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	return ipc_recv_until(from_env_store, pg, perm_store, 0);
+}
+
+// Like ipc_recv, but gives up and returns -E_TIMEOUT if nothing has
+// arrived by the time sys_time_msec() reaches 'msec'.  An 'msec' of 0
+// means wait forever.
+int32_t
+ipc_recv_until(envid_t *from_env_store, void *pg, int *perm_store,
+	       unsigned int msec)
 {
 	int r;
 	// If the destination virtual address 'pg' is null we can signal
@@ -29,7 +39,7 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 	if (pg == NULL) 
 		pg = (void *) UTOP;
 
-	if ((r = sys_ipc_recv(pg)) < 0) {
+	if ((r = sys_ipc_recv_until(pg, msec)) < 0) {
 		// We want to setup a shared memory region but 
 		// the address we gave is not page-aligned!
 		if (from_env_store) *from_env_store = 0;
@@ -46,7 +56,9 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 }
 
 // Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
-// This function keeps trying until it succeeds.
+// This function keeps trying until it succeeds. The kernel queues the 
+// message if 'toenv' isn't receiving, so this only has to retry while 
+// the receiver's queue is full.
 // It should panic() on any error other than -E_IPC_NOT_RECV.
 //
 // Hint:
@@ -69,3 +81,58 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 		sys_yield(); // be CPU-friendly
 	}
 }
+
+// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'to_env' and
+// wait for its reply, in a single system call. The reply's page, if any,
+// is mapped at 'rcv_pg' and its permissions stored in *perm_store, as for
+// ipc_recv. Keeps trying while 'to_env' can't take the request, and
+// panics on any other error.
+// Returns the value of the reply.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm, 
+	 void *rcv_pg, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL) 
+		pg = (void *) UTOP;
+	if (rcv_pg == NULL) 
+		rcv_pg = (void *) UTOP;
+
+	while ((r = sys_ipc_call(to_env, val, pg, perm, rcv_pg)) < 0) {
+		if (r != -E_IPC_NOT_RECV) 
+			panic("ipc_call: %e\n", r);
+		sys_yield();
+	}
+
+	if (perm_store) *perm_store = env->env_ipc_perm;
+	return env->env_ipc_value;
+}
+
+// Send the reply 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to
+// 'to_env', if it's not 0, and wait for the next request, in a single 
+// system call. The request is returned as by ipc_recv.
+int32_t
+ipc_reply_wait(envid_t to_env, uint32_t val, void *pg, int perm,
+	       envid_t *from_env_store, void *rcv_pg, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL) 
+		pg = (void *) UTOP;
+	if (rcv_pg == NULL) 
+		rcv_pg = (void *) UTOP;
+
+	if ((r = sys_ipc_reply_wait(to_env, val, pg, perm, rcv_pg)) < 0) {
+		// The client can't take the reply right now; fall back 
+		// to sending it on its own.
+		if (r != -E_IPC_NOT_RECV) 
+			panic("ipc_reply_wait: %e\n", r);
+		ipc_send(to_env, val, pg, perm);
+		return ipc_recv(from_env_store, rcv_pg, perm_store);
+	}
+
+	if (from_env_store) *from_env_store = env->env_ipc_from;
+	if (perm_store) *perm_store = env->env_ipc_perm;
+	return env->env_ipc_value;
+}
@@ -41,7 +41,8 @@ isfree(void *v, size_t n)
 void*
 malloc(size_t n)
 {
-	int i, cont;
+	int i;
+	struct Pageop ops[2];
 	int nwrap;
 	uint32_t *ref;
 	void *v;
@@ -95,14 +96,28 @@ malloc(size_t n)
 	/*
 	 * allocate at mptr - the +4 makes sure we allocate a ref count.
 	 */
-	for (i = 0; i < n + 4; i += PGSIZE){
-		cont = (i + PGSIZE < n + 4) ? PTE_CONTINUED : 0;
-		if (sys_page_alloc(0, mptr + i, PTE_P|PTE_U|PTE_W|cont) < 0){
-			for (; i >= 0; i -= PGSIZE)
-				sys_page_unmap(0, mptr + i);
+	i = ROUNDUP(n + 4, PGSIZE);
+	if (i > PGSIZE) {
+		/*
+		 * all pages but the last are flagged PTE_CONTINUED, and
+		 * a run is allocated with a single system call.
+		 */
+		ops[0].po_op = ops[1].po_op = PAGEOP_ALLOC;
+		ops[0].po_dstva = mptr;
+		ops[0].po_npages = i / PGSIZE - 1;
+		ops[0].po_perm = PTE_P|PTE_U|PTE_W|PTE_CONTINUED;
+		ops[1].po_dstva = mptr + i - PGSIZE;
+		ops[1].po_npages = 1;
+		ops[1].po_perm = PTE_P|PTE_U|PTE_W;
+		if (sys_page_batch(0, 0, ops, 2) < 0) {
+			ops[0].po_op = PAGEOP_UNMAP;
+			ops[0].po_npages = i / PGSIZE;
+			ops[0].po_dstva = mptr;
+			sys_page_batch(0, 0, ops, 1);
 			return 0;	/* out of physical memory */
 		}
-	}
+	} else if (sys_page_alloc(0, mptr, PTE_P|PTE_U|PTE_W) < 0)
+		return 0;	/* out of physical memory */
 
 	ref = (uint32_t*) (mptr + i - 4);
 	*ref = 2;	/* reference for mptr, reference for returned block */
@@ -116,6 +131,7 @@ free(void *v)
 {
 	uint8_t *c;
 	uint32_t *ref;
+	struct Pageop op;
 
 	if (v == 0)
 		return;
@@ -123,11 +139,17 @@ free(void *v)
 
 	c = ROUNDDOWN(v, PGSIZE);
 
+	/*
+	 * unmap all the PTE_CONTINUED pages with a single system call.
+	 */
+	op.po_op = PAGEOP_UNMAP;
+	op.po_dstva = c;
 	while (vpt[VPN(c)] & PTE_CONTINUED) {
-		sys_page_unmap(0, c);
 		c += PGSIZE;
 		assert(mbegin <= c && c < mend);
 	}
+	if ((op.po_npages = (c - (uint8_t*) op.po_dstva) / PGSIZE))
+		sys_page_batch(0, 0, &op, 1);
 
 	/*
 	 * c is just a piece of this page, so dec the ref count
@@ -0,0 +1,354 @@
+// Memory-mapped files, backed by the file server's block cache.
+//
+// Pages are faulted in lazily by mmap_pgfault, several at a time, as
+// the file server's own cache pages (see FSREQ_READ_MAP), so mapping a
+// file costs one IPC per IPC_MAXPAGES pages touched rather than one per
+// page read.  The cache pages are always mapped read-only, since the
+// file server may free their blocks for reuse while they're mapped; a
+// page is copied the first time it is written.  In shared writable
+// mappings a second copy, the twin, keeps the page as it was, and
+// msync and munmap send the written pages (PTE_D) back to the file
+// server together with their twins.  The server writes only the bytes
+// that differ, so other environments' changes to the rest of the page
+// survive.  The copies are then dropped so the pages are fetched from
+// the cache again; writes not sent back when the environment exits
+// never reach the file.
+
+#include <inc/lib.h>
+
+#define MMAPBASE	0x40000000
+#define MMAPLIM		0x80000000
+#define NMMAP		32
+
+// The twin of a written page of a shared writable mapping
+#define MMAPTWIN(va)	((va) + (MMAPLIM - MMAPBASE))
+
+// Pages touched near a fault are mapped along with it, up to this many
+#define MMAP_FAULTAHEAD	16
+
+// Each mapping keeps a reference to its file's Fd page here, so the file
+// stays open, with the same file ID, after the file descriptor is closed.
+#define MMAPFD(i)	((struct Fd *) (MMAPBASE - ((i) + 1) * PGSIZE))
+
+struct Mmap {
+	uintptr_t m_va;		// first page mapped, or 0 if the slot is free
+	size_t m_len;		// bytes mapped, a multiple of PGSIZE
+	off_t m_offset;		// file offset mapped at m_va
+	int m_prot;		// PROT_*
+	int m_flags;		// MAP_SHARED or MAP_PRIVATE
+};
+
+static struct Mmap mmaps[NMMAP];
+
+extern union Fsipc fsipcbuf;
+
+static int mmap_pgfault(struct UTrapframe *utf);
+
+// Does mapping i overlap [va, va+len)?
+static bool
+mmap_overlaps(int i, uintptr_t va, size_t len)
+{
+	return mmaps[i].m_va && va < mmaps[i].m_va + mmaps[i].m_len
+		&& mmaps[i].m_va < va + len;
+}
+
+// Is the program allowed to write to mapping i's pages in place?
+static bool
+mmap_shared_writable(int i)
+{
+	return (mmaps[i].m_flags & MAP_SHARED) && (mmaps[i].m_prot & PROT_WRITE);
+}
+
+// Permissions for pages of mapping i fetched from the file server.
+// Shared writable mappings keep them, and the copies written to, 
+// shared with forked children.
+static int
+mmap_perm(int i)
+{
+	if (mmap_shared_writable(i))
+		return PTE_P | PTE_U | PTE_SHARE;
+	return PTE_P | PTE_U;
+}
+
+// Find room for 'len' bytes between MMAPBASE and MMAPLIM.
+// Returns 0 if there is none.
+static uintptr_t
+mmap_place(size_t len)
+{
+	uintptr_t va = MMAPBASE;
+	int i;
+
+again:
+	for (i = 0; i < NMMAP; i++)
+		if (mmap_overlaps(i, va, len)) {
+			va = mmaps[i].m_va + mmaps[i].m_len;
+			goto again;
+		}
+	return (va + len <= MMAPLIM) ? va : 0;
+}
+
+static bool
+va_mapped(uintptr_t va)
+{
+	return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
+}
+
+// Map 'len' bytes of the file open as 'fdnum', starting at 'offset',
+// into memory with protection 'prot' (PROT_READ, optionally with
+// PROT_WRITE).  'flags' is MAP_SHARED, so that writes go to the file
+// when msync or munmap writes them back, or MAP_PRIVATE, so they stay
+// private.  If *addr is not NULL, the
+// mapping goes there; otherwise a free place is chosen.  Either way its
+// address is stored in *addr.  The file descriptor may be closed
+// afterwards.  Pages past the end of the file can't be accessed.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NOT_SUPP if fdnum is not a regular file.
+//	-E_INVAL if *addr or offset is not page-aligned, or *addr is
+//		outside [MMAPBASE, MMAPLIM) or overlaps another mapping,
+//		or prot or flags are invalid.
+//	-E_INVAL if a shared writable mapping is asked for a file not open
+//		for writing.
+//	-E_NO_MEM if there are too many mappings or no room for this one.
+int
+mmap(void **addr, size_t len, int prot, int flags, int fdnum, off_t offset)
+{
+	int i, r;
+	uintptr_t va = (uintptr_t) *addr;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	if (!(prot & PROT_READ) || (prot & ~(PROT_READ | PROT_WRITE)))
+		return -E_INVAL;
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE)
+		return -E_INVAL;
+	if ((flags & MAP_SHARED) && (prot & PROT_WRITE)
+	    && (fd->fd_omode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+	if (PGOFF(va) != 0 || PGOFF(offset) != 0 || offset < 0 || len == 0)
+		return -E_INVAL;
+	len = ROUNDUP(len, PGSIZE);
+
+	for (i = 0; i < NMMAP && mmaps[i].m_va; i++)
+		;
+	if (i == NMMAP)
+		return -E_NO_MEM;
+	if (va == 0 && (va = mmap_place(len)) == 0)
+		return -E_NO_MEM;
+	if (va < MMAPBASE || va + len > MMAPLIM || va + len < va)
+		return -E_INVAL;
+	for (r = 0; r < NMMAP; r++)
+		if (mmap_overlaps(r, va, len))
+			return -E_INVAL;
+
+	if ((r = sys_page_map(0, fd, 0, MMAPFD(i), PTE_P | PTE_U)) < 0)
+		return r;
+	add_pgfault_handler(mmap_pgfault);
+
+	mmaps[i].m_va = va;
+	mmaps[i].m_len = len;
+	mmaps[i].m_offset = offset;
+	mmaps[i].m_prot = prot;
+	mmaps[i].m_flags = flags;
+	*addr = (void *) va;
+	return 0;
+}
+
+// Has the page at va been written since it was copied?
+static bool
+va_dirty(uintptr_t va)
+{
+	return va_mapped(va) && (vpt[VPN(va)] & (PTE_W|PTE_D)) == (PTE_W|PTE_D);
+}
+
+// Send the pages of mapping i in [lo, hi) that have been written to
+// back to the file server, with their twins, a run of adjacent pages 
+// at a time, and unmap them and their twins.
+static int
+mmap_writeback(int i, uintptr_t lo, uintptr_t hi)
+{
+	struct Mmap *m = &mmaps[i];
+	uintptr_t va, run = 0;
+	struct Pageop op[2];
+	int r;
+
+	if (!mmap_shared_writable(i))
+		return 0;
+	for (va = lo; va <= hi; va += PGSIZE) {
+		if (va < hi && va_dirty(va)
+		    && (!run || va - run < FSREQ_MAXPAGES / 2 * PGSIZE)) {
+			if (!run)
+				run = va;
+			continue;
+		}
+		if (run) {
+			if ((r = devfile_write_back(MMAPFD(i),
+					m->m_offset + (run - m->m_va), 
+					(void *) run, (void *) MMAPTWIN(run),
+					va - run)) < 0)
+				return r;
+			op[0].po_op = PAGEOP_UNMAP;
+			op[0].po_dstva = (void *) run;
+			op[0].po_npages = (va - run) / PGSIZE;
+			op[1] = op[0];
+			op[1].po_dstva = (void *) MMAPTWIN(run);
+			if ((r = sys_page_batch(0, 0, op, 2)) < 0)
+				return r;
+			run = 0;
+			va -= PGSIZE;	// look at va again
+		}
+	}
+	return 0;
+}
+
+// Write back the shared writable mappings in [addr, addr+len) to disk:
+// the bytes changed in pages written since the last msync go to the
+// file, and the pages are fetched again on the next access, showing
+// other environments' writes.
+// Returns 0 on success, < 0 on error.
+int
+msync(void *addr, size_t len)
+{
+	int i, r;
+	uintptr_t lo = ROUNDDOWN((uintptr_t) addr, PGSIZE);
+	uintptr_t hi = ROUNDUP((uintptr_t) addr + len, PGSIZE);
+
+	for (i = 0; i < NMMAP; i++) {
+		if (!mmap_overlaps(i, lo, hi - lo) || !mmap_shared_writable(i))
+			continue;
+		if ((r = mmap_writeback(i, MAX(lo, mmaps[i].m_va),
+				MIN(hi, mmaps[i].m_va + mmaps[i].m_len))) < 0)
+			return r;
+		if ((r = devfile_flush(MMAPFD(i))) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Remove the mappings of the pages in [addr, addr+len), writing back
+// what was written to shared ones.  Mappings partly inside the range
+// shrink, or split in two around it.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if addr is not page-aligned.
+//	-E_NO_MEM if a mapping needs to be split but there are too many.
+int
+munmap(void *addr, size_t len)
+{
+	int i, j, r;
+	uintptr_t lo = (uintptr_t) addr, hi, start, end;
+	struct Pageop op[2];
+
+	if (PGOFF(lo) != 0)
+		return -E_INVAL;
+	hi = ROUNDUP(lo + len, PGSIZE);
+
+	for (i = 0; i < NMMAP; i++) {
+		if (!mmap_overlaps(i, lo, hi - lo))
+			continue;
+		start = mmaps[i].m_va;
+		end = start + mmaps[i].m_len;
+
+		// A hole in the middle leaves two mappings.
+		j = 0;
+		if (lo > start && hi < end) {
+			for (j = 0; j < NMMAP && mmaps[j].m_va; j++)
+				;
+			if (j == NMMAP)
+				return -E_NO_MEM;
+			if ((r = sys_page_map(0, MMAPFD(i), 0, MMAPFD(j),
+					      PTE_P | PTE_U)) < 0)
+				return r;
+		}
+
+		if ((r = mmap_writeback(i, MAX(lo, start), MIN(hi, end))) < 0)
+			return r;
+		op[0].po_op = PAGEOP_UNMAP;
+		op[0].po_dstva = (void *) MAX(lo, start);
+		op[0].po_npages = (MIN(hi, end) - MAX(lo, start)) / PGSIZE;
+		op[1] = op[0];
+		op[1].po_dstva = (void *) MMAPTWIN(MAX(lo, start));
+		if ((r = sys_page_batch(0, 0, op, 2)) < 0)
+			return r;
+
+		if (lo <= start && hi >= end) {
+			mmaps[i].m_va = 0;
+			sys_page_unmap(0, MMAPFD(i));
+		} else if (lo <= start) {
+			mmaps[i].m_offset += hi - start;
+			mmaps[i].m_va = hi;
+			mmaps[i].m_len = end - hi;
+		} else if (hi >= end) {
+			mmaps[i].m_len = lo - start;
+		} else {
+			mmaps[j] = mmaps[i];
+			mmaps[j].m_offset += hi - start;
+			mmaps[j].m_va = hi;
+			mmaps[j].m_len = end - hi;
+			mmaps[i].m_len = lo - start;
+		}
+	}
+	return 0;
+}
+
+// Page fault handler for mapped files: fetch the faulting page, and
+// the unmapped pages after it, from the file server, and give the
+// mapping its own copy of a page on the first write to it, plus a
+// twin to write back against if the mapping is shared.
+// Returns 0 if the fault isn't one we can deal with.
+static int
+mmap_pgfault(struct UTrapframe *utf)
+{
+	// The fault may have interrupted a file request being put together
+	// or taken apart in fsipcbuf, so save it across ours.
+	static union Fsipc saved;
+	uintptr_t va = ROUNDDOWN(utf->utf_fault_va, PGSIZE);
+	bool write = (utf->utf_err & FEC_WR) != 0;
+	size_t n;
+	int i, r;
+
+	for (i = 0; i < NMMAP; i++)
+		if (mmap_overlaps(i, va, PGSIZE))
+			break;
+	if (i == NMMAP)
+		return 0;
+	if (write && !(mmaps[i].m_prot & PROT_WRITE))
+		return 0;
+
+	if (va_mapped(va) && (!write || (vpt[VPN(va)] & PTE_W)))
+		return 0;	// a protection fault we can't fix
+
+	if (!va_mapped(va)) {
+		for (n = 1; n < MMAP_FAULTAHEAD; n++)
+			if (va + n * PGSIZE >= mmaps[i].m_va + mmaps[i].m_len
+			    || va_mapped(va + n * PGSIZE))
+				break;
+		memmove(&saved, &fsipcbuf, PGSIZE);
+		r = devfile_map(MMAPFD(i), mmaps[i].m_offset + (va - mmaps[i].m_va),
+				(void *) va, n * PGSIZE, mmap_perm(i));
+		memmove(&fsipcbuf, &saved, PGSIZE);
+		if (r <= 0)
+			return 0;	// past the end of the file
+	}
+
+	if (write) {
+		if ((r = sys_page_alloc(0, PFTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("mmap_pgfault: sys_page_alloc: %e", r);
+		memmove(PFTEMP, (void *) va, PGSIZE);
+		if (mmap_shared_writable(i)) {
+			if ((r = sys_page_map(0, PFTEMP, 0, (void *) MMAPTWIN(va),
+					      mmap_perm(i))) < 0)
+				panic("mmap_pgfault: sys_page_map: %e", r);
+			if ((r = sys_page_alloc(0, PFTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+				panic("mmap_pgfault: sys_page_alloc: %e", r);
+			memmove(PFTEMP, (void *) MMAPTWIN(va), PGSIZE);
+		}
+		if ((r = sys_page_map(0, PFTEMP, 0, (void *) va,
+				      mmap_perm(i) | PTE_W)) < 0)
+			panic("mmap_pgfault: sys_page_map: %e", r);
+		sys_page_unmap(0, PFTEMP);
+	}
+	return 1;
+}
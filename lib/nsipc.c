@@ -19,8 +19,8 @@ nsipc(unsigned type)
 	if (debug)
 		cprintf("[%08x] nsipc %d\n", env->env_id, type);
 
-	ipc_send(envs[2].env_id, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
-	return ipc_recv(NULL, NULL, NULL);
+	return ipc_call(envs[2].env_id, type, &nsipcbuf, PTE_P|PTE_W|PTE_U,
+			NULL, NULL);
 }
 
 int
@@ -10,37 +10,83 @@
 // Assembly language pgfault entrypoint defined in lib/pfentry.S.
 extern void _pgfault_upcall(void);
 
-// Pointer to currently installed C-language pgfault handler.
+// Pointer to the C function _pgfault_upcall calls: pgfault_dispatch,
+// once any handler has been set.
 void (*_pgfault_handler)(struct UTrapframe *utf);
 
-//
-// Set the page fault handler function.
-// If there isn't one yet, _pgfault_handler will be 0.
+// Handlers that see each page fault before pgfault_handler does, for
+// faults on memory they manage; see add_pgfault_handler.
+#define NPGFAULT_CLAIM	4
+static int (*pgfault_claims[NPGFAULT_CLAIM])(struct UTrapframe *utf);
+
+// Currently installed C-language pgfault handler.
+static void (*pgfault_handler)(struct UTrapframe *utf);
+
+static void
+pgfault_dispatch(struct UTrapframe *utf)
+{
+	int i;
+
+	for (i = 0; i < NPGFAULT_CLAIM && pgfault_claims[i]; i++)
+		if (pgfault_claims[i](utf))
+			return;
+	if (!pgfault_handler)
+		panic("unhandled page fault va %08x ip %08x err %x", 
+		      utf->utf_fault_va, utf->utf_eip, utf->utf_err);
+	pgfault_handler(utf);
+}
+
 // The first time we register a handler, we need to 
 // allocate an exception stack (one page of memory with its top
 // at UXSTACKTOP), and tell the kernel to call the assembly-language
 // _pgfault_upcall routine when a page fault occurs.
+static void
+pgfault_setup(void)
+{
+	int r;
+
+	if (_pgfault_handler == 0) {
+		// First time through!
+		r = sys_page_alloc(0, (void *)(UXSTACKTOP - PGSIZE),
+				   PTE_U | PTE_W);
+		if (r < 0)
+			panic("set_pgfault_handler: %e\n", r);
+	}
+
+	_pgfault_handler = pgfault_dispatch;
+
+	r = sys_env_set_pgfault_upcall(0, (void *)_pgfault_upcall);
+	if (r < 0)
+		panic("set_pgfault_handler: %e\n", r);
+}
+
+//
+// Set the page fault handler function.
 //
 void
 set_pgfault_handler(void (*handler)(struct UTrapframe *utf))
 {
-int r;
-
-        if (_pgfault_handler == 0) {
-                // First time through!
-                // LAB 4: Your code here.
-                r = sys_page_alloc(0,
-                                   (void *)(UXSTACKTOP - PGSIZE),
-                                   PTE_U | PTE_W);
-                if (r < 0)
-                        panic("set_pgfault_handler: %e\n", r);
-        }
-
-        // Save handler pointer for assembly to call.
-        _pgfault_handler = handler;
-
-        r = sys_env_set_pgfault_upcall(0, (void *)_pgfault_upcall);
-        if (r < 0)
-                panic("set_pgfault_handler: %e\n", r);
+	pgfault_setup();
+	pgfault_handler = handler;
 }
 
+//
+// Add 'claim' to the functions offered each page fault before the
+// handler set with set_pgfault_handler.  'claim' returns 1 if it has
+// dealt with the fault, or 0 to pass it on.  Library code that manages
+// a region of memory uses this to handle faults there, whatever
+// handler the program sets.
+//
+void
+add_pgfault_handler(int (*claim)(struct UTrapframe *utf))
+{
+	int i;
+
+	for (i = 0; i < NPGFAULT_CLAIM && pgfault_claims[i]; i++)
+		if (pgfault_claims[i] == claim)
+			return;
+	if (i == NPGFAULT_CLAIM)
+		panic("add_pgfault_handler: too many handlers");
+	pgfault_setup();
+	pgfault_claims[i] = claim;
+}
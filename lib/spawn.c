@@ -53,8 +53,8 @@ spawn(const char *prog, const char **argv)
 	//        so that multiple instances of the same program
 	//	  will share the same copy of the program text.
 	//        Be sure to map the program text read-only in the child.
-	//        Read_map is like read but returns a pointer to the data in
-	//        *blk rather than copying the data into another buffer.
+	//        Read_map is like read but maps the file server's own pages
+	//        at a given address rather than copying the data into them.
 	//
 	//	* If the ELF segment flags DO include ELF_PROG_FLAG_WRITE,
 	//	  then the segment contains read/write data and bss.
@@ -235,7 +235,9 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 	int fd, size_t filesz, off_t fileoffset, int perm)
 {
 	int i, r;
+	size_t shared, n;
 	void *blk;
+	struct Pageop op;
 
 	//cprintf("map_segment %x+%x\n", va, memsz);
 
@@ -246,11 +248,41 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 		fileoffset -= i;
 	}
 
-	for (i = 0; i < memsz; i += PGSIZE) {
+	// Share the file server's pages for whole pages of a read-only
+	// segment, and for its last page too unless bss follows in it.
+	shared = 0;
+	if (!(perm & PTE_W) && PGOFF(fileoffset) == 0)
+		shared = (memsz == filesz ? ROUNDUP(filesz, PGSIZE) 
+			  : ROUNDDOWN(filesz, PGSIZE));
+	for (i = 0; i < shared; i += n * PGSIZE) {
+		if ((r = read_map(fd, fileoffset + i, UTEMP, shared - i)) < 0)
+			return r;
+		if (r == 0)
+			return -E_INVAL;	// file shorter than the segment
+		n = ROUNDUP(r, PGSIZE) / PGSIZE;
+		op.po_op = PAGEOP_MAP;
+		op.po_srcva = UTEMP;
+		op.po_dstva = (void*) (va + i);
+		op.po_npages = n;
+		op.po_perm = perm;
+		r = sys_page_batch(0, child, &op, 1);
+		op.po_op = PAGEOP_UNMAP;
+		op.po_dstva = UTEMP;
+		op.po_npages = n;
+		sys_page_batch(0, 0, &op, 1);
+		if (r < 0)
+			return r;
+	}
+	i = shared;
+
+	for (; i < memsz; i += PGSIZE) {
 		if (i >= filesz) {
-			// allocate a blank page
-			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
-				return r;
+			// allocate all the remaining blank pages at once
+			op.po_op = PAGEOP_ALLOC;
+			op.po_dstva = (void*) (va + i);
+			op.po_npages = (ROUNDUP(memsz, PGSIZE) - i) / PGSIZE;
+			op.po_perm = perm;
+			return sys_page_batch(0, child, &op, 1);
 		} else {
 			// from file
 			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
@@ -73,6 +73,12 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	return syscall(SYS_page_alloc, 1, envid, (uint32_t) va, perm, 0, 0);
 }
 
+int
+sys_page_alloc_super(envid_t envid, void *va, int perm)
+{
+	return syscall(SYS_page_alloc_super, 0, envid, (uint32_t) va, perm, 0, 0);
+}
+
 int
 sys_page_map(envid_t srcenv, void *srcva, envid_t dstenv, void *dstva, int perm)
 {
@@ -85,14 +91,38 @@ sys_page_unmap(envid_t envid, void *va)
 	return syscall(SYS_page_unmap, 1, envid, (uint32_t) va, 0, 0, 0);
 }
 
+int
+sys_page_batch(envid_t srcenv, envid_t dstenv, struct Pageop *ops, unsigned nops)
+{
+	return syscall(SYS_page_batch, 0, srcenv, dstenv, (uint32_t) ops, nops, 0);
+}
+
 // sys_exofork is inlined in lib.h
 
+envid_t
+sys_fork(void)
+{
+	return syscall(SYS_fork, 0, 0, 0, 0, 0, 0);
+}
+
 int
 sys_env_set_status(envid_t envid, int status)
 {
 	return syscall(SYS_env_set_status, 1, envid, status, 0, 0, 0);
 }
 
+int
+sys_env_set_priority(envid_t envid, int prio)
+{
+	return syscall(SYS_env_set_priority, 1, envid, prio, 0, 0, 0);
+}
+
+int
+sys_env_stat(envid_t envid, struct Envstat *st)
+{
+	return syscall(SYS_env_stat, 0, envid, (uint32_t) st, 0, 0, 0);
+}
+
 int
 sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 {
@@ -111,18 +141,51 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_send_pages(envid_t envid, uint32_t value, void **pgs, unsigned npages, int perm)
+{
+	return syscall(SYS_ipc_send_pages, 0, envid, value, (uint32_t) pgs, npages, perm);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_recv_until(void *dstva, unsigned int msec)
+{
+	return syscall(SYS_ipc_recv_until, 0, (uint32_t) dstva, msec, 0, 0, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_call, 0, envid, value, (uint32_t) srcva, perm, 
+		(uint32_t) dstva);
+}
+
+int
+sys_ipc_reply_wait(envid_t envid, uint32_t value, void *srcva, int perm, 
+	void *dstva)
+{
+	return syscall(SYS_ipc_reply_wait, 0, envid, value, (uint32_t) srcva, 
+		perm, (uint32_t) dstva);
+}
+
 unsigned int
 sys_time_msec(void)
 {
 	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
 }
 
+int
+sys_sleep_until(unsigned int msec)
+{
+	return syscall(SYS_sleep_until, 0, msec, 0, 0, 0, 0);
+}
+
 int
 sys_xmit_frame(const char *data, uint16_t len) {
 	return syscall(SYS_xmit_frame, 1, (uint32_t) data, len, 0, 0, 0);
@@ -133,3 +196,43 @@ sys_rx(char *data) {
 	return syscall(SYS_rx, 0, (uint32_t) data, 0, 0, 0, 0);
 }
 
+int
+sys_rx_wait(char *data) {
+	return syscall(SYS_rx_wait, 0, (uint32_t) data, 0, 0, 0, 0);
+}
+
+int
+sys_rx_batch(void *va, int max) {
+	return syscall(SYS_rx_batch, 0, (uint32_t) va, max, 0, 0, 0);
+}
+
+int
+sys_rx_map(void *dstva) {
+	return syscall(SYS_rx_map, 0, (uint32_t) dstva, 0, 0, 0, 0);
+}
+
+int
+sys_xmit_frags(struct jif_sg *sg) {
+	return syscall(SYS_xmit_frags, 0, (uint32_t) sg, 0, 0, 0, 0);
+}
+
+int
+sys_xmit_wait(const char *data, uint16_t len) {
+	return syscall(SYS_xmit_wait, 1, (uint32_t) data, len, 0, 0, 0);
+}
+
+int
+sys_rx_ring(struct jif_ring *ring) {
+	return syscall(SYS_rx_ring, 1, (uint32_t) ring, 0, 0, 0, 0);
+}
+
+int
+sys_ring_wait(struct jif_ring *ring) {
+	return syscall(SYS_ring_wait, 0, (uint32_t) ring, 0, 0, 0, 0);
+}
+
+int
+sys_ring_notify(envid_t envid) {
+	return syscall(SYS_ring_notify, 0, envid, 0, 0, 0, 0);
+}
+
@@ -0,0 +1,26 @@
+// Reading the kernel's clock through the read-only page at UTIME,
+// without a system call.
+
+#include <inc/lib.h>
+
+// Milliseconds since boot, on the same clock as sys_time_msec and the
+// deadlines of sys_sleep_until and sys_ipc_recv_until.
+unsigned int
+time_msec(void)
+{
+	return timepage.tp_msec;
+}
+
+// Microseconds since boot, from the TSC.
+uint64_t
+time_usec(void)
+{
+	return timepage_nsec(&timepage) / 1000;
+}
+
+// Nanoseconds since boot, from the TSC.
+uint64_t
+time_nsec(void)
+{
+	return timepage_nsec(&timepage);
+}
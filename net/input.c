@@ -3,33 +3,90 @@
 
 extern union Nsipc nsipcbuf;
 
+// Maximum number of packets to deliver to the network server in one IPC.
+#define RX_BATCH	32
+
+// Flag to map the pages packets are received into straight through to the
+// network server (one IPC per packet, no copies) instead of batching them 
+// out of the receive ring.
+static int rx_zerocopy = 1;
+
+//
+// Map a struct jif_ring at JIF_RXRING and have the kernel copy received
+// packets into it as they arrive.
+//
+static void
+rx_ring_init(void)
+{
+	int i, r;
+
+	for (i = 0; i < JIF_RING_PAGES; i++)
+		if ((r = sys_page_alloc(0, (char *) JIF_RXRING + i * PGSIZE, 
+				PTE_P|PTE_W|PTE_U)) < 0)
+			panic("rx_ring_init: sys_page_alloc: %e", r);
+	if ((r = sys_rx_ring(JIF_RXRING)) < 0)
+		panic("rx_ring_init: sys_rx_ring: %e", r);
+}
+
 void
 input(envid_t ns_envid)
 {
-	int len;
-	char data[1518];
+	int n, r;
+	size_t off;
+	struct jif_pkt *pkt, *rec;
+
 	binaryname = "ns_input";
 
 	while (1) {
 		// Packets received by the network card need to be injected into lwIP.
-		// For every packet received by the device driver, this input environment 
-		// pulls the packet out of kernel space and sends the packet to the core 
-		// server environment using the NSREQ_INPUT IPC message. The core network 
-		// server expects all IPC input messages to have a page attached with a 
-		// union Nsipc with its struct jif_pkt pkt field filled in.
+		// For every burst of packets received by the device driver, this input 
+		// environment pulls the packets out of kernel space and sends them to 
+		// the core server environment using a single NSREQ_INPUT IPC message. 
+		// The core network server expects all IPC input messages to have a page 
+		// attached with a union Nsipc holding one or more struct jif_pkt records.
+
+		if (rx_zerocopy) {
+			// Sleep in the device driver until a packet is received and 
+			// have the page it was received into mapped at nsipcbuf.
+			// The kernel may have been booted with packed RFDs that can't
+			// be flipped, in which case fall back to the receive ring.
+			if ((r = sys_rx_map(&nsipcbuf)) < 0) {
+				if (r == -E_NOT_SUPP) {
+					rx_zerocopy = 0;
+					rx_ring_init();
+				}
+				continue;
+			}
+
+			ipc_send(ns_envid, NSREQ_INPUT_RFD, &nsipcbuf, PTE_P|PTE_W|PTE_U);
+			continue;
+		}
 
-		// Poll the device driver for recieved packets.
-		while ((len = sys_rx(data)) < 0)
-			sys_yield();
+		// Sleep until the kernel puts a packet in the receive ring. While 
+		// packets keep arriving this takes no system calls at all.
+		pkt = ring_wait(JIF_RXRING);
 
-		// Allocate a new page for every packet we recieve from the
+		// Allocate a new page for every burst we recieve from the
 		// device driver before IPCing it to the network server.
 		sys_page_alloc(0, &nsipcbuf, PTE_P|PTE_W|PTE_U);
-		nsipcbuf.pkt.jp_len = len;
-		memmove(nsipcbuf.pkt.jp_data, data, len);
 
-		// Forward each packet to the core network server environment.
+		// Pack as many of the waiting packets as fit into the page.
+		off = 0;
+		for (n = 0; pkt && n < RX_BATCH; n++) {
+			if (off + sizeof(struct jif_pkt) + pkt->jp_len > PGSIZE)
+				break;
+			rec = (struct jif_pkt *) ((char *) &nsipcbuf + off);
+			rec->jp_len = pkt->jp_len;
+			memmove(rec->jp_data, pkt->jp_data, pkt->jp_len);
+			off += (char *) JIF_PKT_NEXT(rec) - (char *) rec;
+
+			jif_ring_pop(JIF_RXRING);
+			pkt = jif_ring_cons(JIF_RXRING);
+		}
+		if (off + sizeof(struct jif_pkt) <= PGSIZE)
+			((struct jif_pkt *) ((char *) &nsipcbuf + off))->jp_len = 0;
+
+		// Forward the burst to the core network server environment.
 		ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf, PTE_P|PTE_W|PTE_U);
 	}
 }
-
@@ -31,12 +31,38 @@ thread_wakeup(volatile uint32_t *addr) {
     }
 }
 
+// Returns the time at which the first of the other threads blocked in
+// thread_wait times out, ~0 if none of them ever does, or 0 if one of
+// them can make progress right now: it was woken up, the value it waits
+// on changed, its time is up, or it isn't in thread_wait at all.  A
+// thread of the last kind must block some other way, in ns in 
+// ipc_recv_until with this deadline, for the environment to sleep.
+uint32_t
+thread_idle_until(void) {
+    struct thread_context *tc = thread_queue.tq_first;
+    uint32_t now = time_msec();
+    uint32_t until = ~0;
+    while (tc) {
+	if (!tc->tc_waiting || tc->tc_wakeup || tc->tc_wait_msec <= now ||
+	    (tc->tc_wait_addr && *tc->tc_wait_addr != tc->tc_wait_val))
+	    return 0;
+	if (tc->tc_wait_msec < until)
+	    until = tc->tc_wait_msec;
+	tc = tc->tc_queue_link;
+    }
+    return until;
+}
+
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
+    uint32_t s = time_msec();
     uint32_t p = s;
+    uint32_t until;
 
     cur_tc->tc_wait_addr = addr;
+    cur_tc->tc_wait_val = val;
+    cur_tc->tc_wait_msec = msec;
+    cur_tc->tc_waiting = 1;
     cur_tc->tc_wakeup = 0;
 
     while (p < msec) {
@@ -47,11 +73,17 @@ thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
 	if (cur_tc->tc_wakeup)
 	    break;
 
-	thread_yield();
-	p = sys_time_msec();
+	// If every thread is waiting, nothing can happen until one of
+	// them times out, so sleep in the kernel instead of spinning.
+	if ((until = thread_idle_until()) != 0)
+	    sys_sleep_until(MIN(until, msec));
+	else
+	    thread_yield();
+	p = time_msec();
     }
 
     cur_tc->tc_wait_addr = 0;
+    cur_tc->tc_waiting = 0;
     cur_tc->tc_wakeup = 0;
 }
 
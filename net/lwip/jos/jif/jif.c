@@ -44,8 +44,6 @@
 
 #include <netif/etharp.h>
 
-#define PKTMAP		0x10000000
-
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
@@ -69,6 +67,95 @@ low_level_init(struct netif *netif)
     netif->hwaddr[5] = 0x56;
 }
 
+/*
+ * Packets sent with sys_xmit_frags are read by the nic straight out
+ * of their pbufs, so we hold a reference to each one until the kernel
+ * reports it as sent, either when the next packet is sent or when ns
+ * calls jif_tx_reclaim.
+ */
+#define TX_INFLIGHT	32
+
+static struct {
+    struct pbuf *p;
+    uint32_t seq;
+} tx_inflight[TX_INFLIGHT];
+static int tx_head, tx_count;
+
+static void
+tx_retire(uint32_t done)
+{
+    while (tx_count > 0 && (int32_t)(tx_inflight[tx_head].seq - done) < 0) {
+	pbuf_free(tx_inflight[tx_head].p);
+	tx_head = (tx_head + 1) % TX_INFLIGHT;
+	tx_count--;
+    }
+}
+
+/*
+ * jif_tx_reclaim():
+ *
+ * Drops our references to the pbufs of packets the nic has finished
+ * sending, without sending anything. Returns the number of packets
+ * still in flight.
+ *
+ */
+int
+jif_tx_reclaim(void)
+{
+    struct jif_sg sg;
+
+    if (tx_count == 0)
+	return 0;
+    sg.sg_nfrags = 0;
+    if (sys_xmit_frags(&sg) == 0)
+	tx_retire(sg.sg_done);
+    return tx_count;
+}
+
+/*
+ * low_level_output_sg():
+ *
+ * Transmits the packet without flattening the pbuf chain by handing
+ * each pbuf to the nic as a separate fragment. Returns 0 on success
+ * or < 0 if the packet has to go through the copying path instead.
+ * When the nic's transmit ring is full the kernel blocks us until the
+ * nic catches up, so lwIP is slowed down rather than losing frames.
+ *
+ */
+static int
+low_level_output_sg(struct pbuf *p)
+{
+    struct jif_sg sg;
+    struct pbuf *q;
+    int r;
+
+    if (tx_count == TX_INFLIGHT && jif_tx_reclaim() == TX_INFLIGHT)
+	return -E_NO_MEM;
+
+    sg.sg_nfrags = 0;
+    for (q = p; q != NULL; q = q->next) {
+	if (q->len == 0)
+	    continue;
+	if (sg.sg_nfrags == JIF_SG_MAXFRAGS)
+	    return -E_INVAL;
+	sg.sg_frags[sg.sg_nfrags].jf_va = q->payload;
+	sg.sg_frags[sg.sg_nfrags].jf_len = q->len;
+	sg.sg_nfrags++;
+    }
+
+    pbuf_ref(p);
+    if ((r = sys_xmit_frags(&sg)) < 0) {
+	pbuf_free(p);
+	return r;
+    }
+
+    tx_inflight[(tx_head + tx_count) % TX_INFLIGHT].p = p;
+    tx_inflight[(tx_head + tx_count) % TX_INFLIGHT].seq = sg.sg_seq;
+    tx_count++;
+    tx_retire(sg.sg_done);
+    return 0;
+}
+
 /*
  * low_level_output():
  *
@@ -80,10 +167,22 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
+    if (low_level_output_sg(p) == 0)
+	return ERR_OK;
+
+    /* Copy the packet straight into the next slot of the transmit ring
+       shared with the output environment, sleeping until it makes room
+       if the ring is full. It rings our doorbell when it sees
+       jr_prodwait, so look again after setting it in case it already
+       made room. */
+    struct jif_pkt *pkt;
+    while ((pkt = jif_ring_prod(JIF_TXRING)) == NULL) {
+	JIF_TXRING->jr_prodwait = 1;
+	jif_ring_mb();
+	if (jif_ring_prod(JIF_TXRING) == NULL)
+	    sys_ring_wait(JIF_TXRING);
+	JIF_TXRING->jr_prodwait = 0;
+    }
 
     struct jif *jif;
     jif = netif->state;
@@ -96,7 +195,7 @@ low_level_output(struct netif *netif, struct pbuf *p)
 	   time. The size of the data in each pbuf is kept in the ->len
 	   variable. */
 
-	if (txsize + q->len > 2000)
+	if (txsize + q->len > JIF_RING_SLOTSIZE - sizeof(*pkt))
 	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
 	memcpy(&txbuf[txsize], q->payload, q->len);
 	txsize += q->len;
@@ -104,8 +203,9 @@ low_level_output(struct netif *netif, struct pbuf *p)
 
     pkt->jp_len = txsize;
 
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+    /* Only wake the output environment if it found the ring empty. */
+    if (jif_ring_push(JIF_TXRING))
+	sys_ring_notify(jif->envid);
 
     return ERR_OK;
 }
@@ -163,17 +263,15 @@ jif_output(struct netif *netif, struct pbuf *p,
 }
 
 /*
- * jif_input():
+ * jif_input_pkt():
  *
- * This function should be called when a packet is ready to be read
- * from the interface. It uses the function low_level_input() that
- * should handle the actual reception of bytes from the network
- * interface.
+ * Hands a single received packet to the TCP/IP stack. It uses the
+ * function low_level_input() to copy the packet into a pbuf.
  *
  */
 
-void
-jif_input(struct netif *netif, void *va)
+static void
+jif_input_pkt(struct netif *netif, struct jif_pkt *pkt)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
@@ -182,7 +280,7 @@ jif_input(struct netif *netif, void *va)
     jif = netif->state;
   
     /* move received packet into a new pbuf */
-    p = low_level_input(va);
+    p = low_level_input(pkt);
 
     /* no packet could be read, silently ignore this */
     if (p == NULL) return;
@@ -209,6 +307,29 @@ jif_input(struct netif *netif, void *va)
     }
 }
 
+/*
+ * jif_input():
+ *
+ * This function should be called when a page of packets is ready to
+ * be read from the interface. Starting at va, the page holds one or
+ * more struct jif_pkt records packed back to back (see JIF_PKT_NEXT),
+ * each of which is handed to jif_input_pkt().
+ *
+ */
+
+void
+jif_input(struct netif *netif, void *va)
+{
+    struct jif_pkt *pkt = (struct jif_pkt *)va;
+    char *end = ROUNDDOWN((char *)va, PGSIZE) + PGSIZE;
+
+    while ((char *)pkt + sizeof(*pkt) <= end && pkt->jp_len > 0 &&
+	   pkt->jp_data + pkt->jp_len <= end) {
+	jif_input_pkt(netif, pkt);
+	pkt = JIF_PKT_NEXT(pkt);
+    }
+}
+
 /*
  * jif_init():
  *
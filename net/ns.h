@@ -20,3 +20,8 @@ void input(envid_t ns_envid);
 /* output.c */
 void output(envid_t ns_envid);
 
+/* ring.c */
+struct jif_pkt *ring_wait(struct jif_ring *r);
+void ring_put(struct jif_ring *r, envid_t consumer, const void *data, int len);
+void tx_ring_init(envid_t output_envid);
+
@@ -1,25 +1,32 @@
 #include "ns.h"
 
-extern union Nsipc nsipcbuf;
-
 //
-// Accept NSREQ_OUTPUT IPC messages from the core network server and send the 
-// packets accompanying these IPC message to the network device driver
+// Send the packets the core network server puts in the transmit ring at 
+// JIF_TXRING (see tx_ring_init) to the network device driver.
 //
 void
 output(envid_t ns_envid)
 {
+	struct jif_pkt *pkt;
+
 	binaryname = "ns_output";
 
+	// Wait for the core network server to map the transmit ring.
+	while (ipc_recv(NULL, NULL, NULL) != NSREQ_OUTPUT)
+		;
+
 	while (1) {
 		// When servicing user environment socket calls, lwIP will generate packets 
-		// for the network card to transmit. LwIP will send each packet to be 
-		// transmitted to this output helper environment using the NSREQ_OUTPUT IPC 
-		// message with the packet attached in the page argument of the IPC message.
-		if (ipc_recv(NULL, &nsipcbuf, NULL) != NSREQ_OUTPUT)
-			continue;
+		// for the network card to transmit. LwIP puts each packet to be transmitted
+		// in the transmit ring, and only wakes us up if we found the ring empty. 
+		pkt = ring_wait(JIF_TXRING);
 
-		// Forward the packet to the E100 device driver to transmit.
-		sys_xmit_frame(nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len);
+		// Forward the packet to the E100 device driver to transmit. If the 
+		// transmit DMA ring is full we sleep until there is room for it,
+		// which in turn makes the transmit ring fill up and the core network 
+		// server wait for us.
+		sys_xmit_wait(pkt->jp_data, pkt->jp_len);
+		if (jif_ring_pop(JIF_TXRING))
+			sys_ring_notify(ns_envid);
 	}	
 }
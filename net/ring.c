@@ -0,0 +1,71 @@
+#include "ns.h"
+
+//
+// Consumer side of a struct jif_ring (see inc/ns.h): return the next packet
+// in ring r, sleeping until the producer adds one if the ring is empty.
+//
+struct jif_pkt *
+ring_wait(struct jif_ring *r)
+{
+	struct jif_pkt *pkt;
+
+	while (!(pkt = jif_ring_cons(r))) {
+		// Tell the producer to ring our doorbell, then look again in
+		// case it added a packet before it could have seen the flag.
+		r->jr_waiting = 1;
+		jif_ring_mb();
+		if (!jif_ring_cons(r))
+			sys_ring_wait(r);
+		r->jr_waiting = 0;
+	}
+	return pkt;
+}
+
+//
+// Producer side of a struct jif_ring: copy the 'len' byte packet at 'data'
+// into ring r, sleeping while the ring is full, and ring the doorbell of 
+// the consumer environment if it is waiting for a packet.
+//
+void
+ring_put(struct jif_ring *r, envid_t consumer, const void *data, int len)
+{
+	struct jif_pkt *pkt;
+
+	while (!(pkt = jif_ring_prod(r))) {
+		// Tell the consumer to ring our doorbell once it makes room,
+		// then look again in case it did before it could see the flag.
+		r->jr_prodwait = 1;
+		jif_ring_mb();
+		if (!jif_ring_prod(r))
+			sys_ring_wait(r);
+		r->jr_prodwait = 0;
+	}
+
+	pkt->jp_len = len;
+	memmove(pkt->jp_data, data, len);
+	if (jif_ring_push(r))
+		sys_ring_notify(consumer);
+}
+
+//
+// Set up the transmit ring at JIF_TXRING, shared between us as the producer
+// and the output environment as the consumer. The pages are allocated after
+// the output environment has been forked, since fork would have made them 
+// copy-on-write, and then mapped into it. The output environment waits for 
+// an NSREQ_OUTPUT message saying the ring is ready before it touches it.
+//
+void
+tx_ring_init(envid_t output_envid)
+{
+	int i, r;
+	void *va;
+
+	for (i = 0; i < JIF_RING_PAGES; i++) {
+		va = (char *) JIF_TXRING + i * PGSIZE;
+		if ((r = sys_page_alloc(0, va, PTE_P|PTE_W|PTE_U)) < 0)
+			panic("tx_ring_init: sys_page_alloc: %e", r);
+		if ((r = sys_page_map(0, va, output_envid, va, PTE_P|PTE_W|PTE_U)) < 0)
+			panic("tx_ring_init: sys_page_map: %e", r);
+	}
+	ipc_send(output_envid, NSREQ_OUTPUT, 0, 0);
+}
@@ -33,6 +33,10 @@ struct netif nif;
 
 #define debug 0
 
+// How long to wait before looking again for packets the nic has sent,
+// while it's still sending some.
+#define TX_RECLAIM_MSEC	10
+
 struct timer_thread {
 	uint32_t msec;
 	void (*func)(void);
@@ -101,7 +105,7 @@ net_timer(uint32_t arg)
 	struct timer_thread *t = (struct timer_thread *) arg;
 
 	for (;;) {
-		uint32_t cur = sys_time_msec();
+		uint32_t cur = time_msec();
 
 		lwip_core_lock();
 		t->func();
@@ -169,9 +173,9 @@ process_timer(envid_t envid) {
 		return;
 	}
 
-	start = sys_time_msec();
+	start = time_msec();
 	thread_yield();
-	now = sys_time_msec();
+	now = time_msec();
 
 	to = TIMER_INTERVAL - (now - start);
 	ipc_send(envid, to, 0, 0);
@@ -233,6 +237,10 @@ serve_thread(uint32_t a) {
 		jif_input(&nif, (void *)&req->pkt);
 		r = 0;
 		break;
+	case NSREQ_INPUT_RFD:
+		jif_input(&nif, (void *)&req->inputRfd.req_pkt);
+		r = 0;
+		break;
 	default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
 		r = -E_INVAL;
@@ -245,7 +253,7 @@ serve_thread(uint32_t a) {
 		perror(buf);
 	}
 
-	if (args->reqno != NSREQ_INPUT)
+	if (args->reqno != NSREQ_INPUT && args->reqno != NSREQ_INPUT_RFD)
 		ipc_send(args->whom, r, 0, 0);
 
 	put_buffer(args->req);
@@ -256,7 +264,7 @@ serve_thread(uint32_t a) {
 void
 serve(void) {
 	int32_t reqno;
-	uint32_t whom;
+	uint32_t whom, until;
 	int i, perm;
 	void *va;
 	
@@ -264,16 +272,33 @@ serve(void) {
 		// ipc_recv will block the entire process, so we flush
 		// all pending work from other threads.  We limit the
 		// number of yields in case there's a rogue thread.
-		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
+		for (i = 0; (until = thread_idle_until()) == 0 && i < 32; ++i)
 			thread_yield();
 
+		// Let go of the pbufs of packets the nic has sent since, and
+		// if it's still sending some, come back for them a little
+		// later even if nothing else happens.
+		lwip_core_lock();
+		if (jif_tx_reclaim() > 0)
+			until = MIN(until, time_msec() + TX_RECLAIM_MSEC);
+		lwip_core_unlock();
+
+		// Then sleep until a request arrives or the first of the 
+		// other threads' timeouts, whichever comes first.
 		perm = 0;
 		va = get_buffer();
-		reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		reqno = ipc_recv_until((int32_t *) &whom, (void *) va, &perm,
+				       until == (uint32_t) ~0 ? 0 : 
+				       MAX(until, 1));
 		if (debug) {
 			cprintf("ns req %d from %08x\n", reqno, whom);
 		}
 
+		if (reqno == -E_TIMEOUT) {
+			put_buffer(va);
+			continue;
+		}
+
 		// first take care of requests that do not contain an argument page
 		if (reqno == NSREQ_TIMER) {
 			process_timer(whom);
@@ -317,6 +342,10 @@ umain(void)
 
 	binaryname = "ns";
 
+	// Run ahead of CPU-bound environments when packets or requests 
+	// arrive. The helper environments forked below inherit this.
+	sys_env_set_priority(0, ENV_PRIO_SERVER);
+
 	// fork off the timer thread which will send us periodic messages
 	timer_envid = fork();
 	if (timer_envid < 0)
@@ -345,6 +374,7 @@ umain(void)
 		output(ns_envid);
 		return;
 	}
+	tx_ring_init(output_envid);
 
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization. 
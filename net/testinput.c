@@ -39,7 +39,7 @@ announce(void)
 	memset(arp->dhwaddr.addr,  0x00,  ETHARP_HWADDR_LEN);
 	memcpy(arp->dipaddr.addrw, &gwip, 4);
 
-	ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
+	ring_put(JIF_TXRING, output_envid, pkt->jp_data, pkt->jp_len);
 	sys_page_unmap(0, pkt);
 }
 
@@ -79,6 +79,7 @@ umain(void)
 		output(ns_envid);
 		return;
 	}
+	tx_ring_init(output_envid);
 
 	input_envid = fork();
 	if (input_envid < 0)
@@ -101,10 +102,16 @@ umain(void)
 			panic("ipc_recv: %e", req);
 		if (whom != input_envid)
 			panic("IPC from unexpected environment %08x", whom);
-		if (req != NSREQ_INPUT)
+		if (req != NSREQ_INPUT && req != NSREQ_INPUT_RFD)
 			panic("Unexpected IPC %d", req);
 
-		hexdump("input: ", pkt->jp_data, pkt->jp_len);
-		cprintf("\n");
+		struct jif_pkt *p = pkt;
+		if (req == NSREQ_INPUT_RFD)
+			p = &((union Nsipc *)pkt)->inputRfd.req_pkt;
+		for (; (char *)p + sizeof(*p) <= (char *)pkt + PGSIZE &&
+			     p->jp_len > 0; p = JIF_PKT_NEXT(p)) {
+			hexdump("input: ", p->jp_data, p->jp_len);
+			cprintf("\n");
+		}
 	}
 }
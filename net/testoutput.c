@@ -24,6 +24,7 @@ umain(void)
 		output(ns_envid);
 		return;
 	}
+	tx_ring_init(output_envid);
 
 	for (i = 0; i < TESTOUTPUT_COUNT; i++) {
 		if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
@@ -32,11 +33,11 @@ umain(void)
 				       PGSIZE - sizeof(pkt->jp_len),
 				       "Packet %02d", i);
 		cprintf("Transmitting packet %d\n", i);
-		ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
+		ring_put(JIF_TXRING, output_envid, pkt->jp_data, pkt->jp_len);
 		sys_page_unmap(0, pkt);
 	}
 
-	// Spin for a while, just in case IPC's or packets need to be flushed
+	// Spin for a while, just in case packets need to be flushed
 	for (i = 0; i < TESTOUTPUT_COUNT*2; i++)
 		sys_yield();
 }
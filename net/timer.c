@@ -2,27 +2,32 @@
 
 void
 timer(envid_t ns_envid, uint32_t initial_to) {
-	uint32_t stop = sys_time_msec() + initial_to;
+	uint32_t stop = time_msec() + initial_to;
 
 	binaryname = "ns_timer";
 
 	while (1) {
-		while(sys_time_msec() < stop) {
-			sys_yield();
-		}
+		sys_sleep_until(stop);
 
 		ipc_send(ns_envid, NSREQ_TIMER, 0, 0);
 
 		while (1) {
-			uint32_t to, whom;
-			to = ipc_recv((int32_t *) &whom, 0, 0);
+			int32_t to;
+			uint32_t whom;
+			// If ns never answers, ping it again a period later.
+			to = ipc_recv_until((int32_t *) &whom, 0, 0, 
+					    time_msec() + TIMER_INTERVAL);
+			if (to == -E_TIMEOUT) {
+				stop = time_msec();
+				break;
+			}
 
 			if (whom != ns_envid) {
 				cprintf("NS TIMER: timer thread got IPC message from env %x not NS\n", whom);
 				continue;
 			}
 
-			stop = sys_time_msec() + to;
+			stop = time_msec() + to;
 			break;
 		}
 	}
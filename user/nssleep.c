@@ -0,0 +1,32 @@
+// Check that the network server sleeps in the kernel while it has
+// nothing to do, rather than spinning through its threads.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+// ns is the third environment kern/init.c creates, after idle and fs.
+#define NS_ENV	(&envs[2])
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t tsc, run;
+	const volatile struct Env *ns = NS_ENV;
+
+	// Give ns time to come up and settle.
+	sys_sleep_until(sys_time_msec() + 2000);
+	if (ns->env_status == ENV_FREE)
+		panic("nssleep: ns is not running");
+
+	tsc = read_tsc();
+	run = ns->env_stat.es_run;
+	sys_sleep_until(sys_time_msec() + 1000);
+	tsc = read_tsc() - tsc;
+	run = ns->env_stat.es_run - run;
+
+	cprintf("ns ran %u of %u Mcycles\n", (uint32_t) (run >> 20),
+		(uint32_t) (tsc >> 20));
+	if (run > tsc / 10)
+		panic("nssleep: ns is spinning instead of sleeping");
+	cprintf("nssleep: OK\n");
+}
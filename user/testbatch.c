@@ -0,0 +1,68 @@
+// Test sys_page_batch: a batch of operations is carried out in order,
+// and when one fails, ops records exactly how far the batch got.
+
+#include <inc/lib.h>
+
+#define VA		((char *) 0xD0000000)
+#define P(i)		(VA + (i) * PGSIZE)
+
+static bool
+va_mapped(void *va)
+{
+	return (vpd[PDX(va)] & PTE_P) && (vpt[VPN(va)] & PTE_P);
+}
+
+void
+umain(void)
+{
+	struct Pageop ops[3];
+	int i, r;
+
+	// Allocate P(0..3), share P(0..1) at P(8..9), then unmap P(0).
+	ops[0] = (struct Pageop) { PAGEOP_ALLOC, 0, P(0), 4, PTE_P|PTE_U|PTE_W };
+	ops[1] = (struct Pageop) { PAGEOP_MAP, P(0), P(8), 2, PTE_P|PTE_U|PTE_W };
+	ops[2] = (struct Pageop) { PAGEOP_UNMAP, 0, P(0), 1, 0 };
+	if ((r = sys_page_batch(0, 0, ops, 3)) < 0)
+		panic("sys_page_batch: %e", r);
+	for (i = 0; i < 3; i++)
+		if (ops[i].po_npages != 0)
+			panic("op %d has %d pages left", i, ops[i].po_npages);
+	if (va_mapped(P(0)))
+		panic("P(0) still mapped");
+	for (i = 1; i < 4; i++)
+		if (!va_mapped(P(i)))
+			panic("P(%d) not mapped", i);
+	strcpy(P(1), "shared");
+	if (strcmp(P(9), "shared") != 0)
+		panic("P(9) says '%s', not 'shared'", P(9));
+	if (!va_mapped(P(8)))
+		panic("P(8) not mapped");
+
+	// Allocate P(4..5), then map P(3..6) at P(16..19): P(6) isn't
+	// mapped, so the second operation fails on its last page and the
+	// third is never started.
+	ops[0] = (struct Pageop) { PAGEOP_ALLOC, 0, P(4), 2, PTE_P|PTE_U|PTE_W };
+	ops[1] = (struct Pageop) { PAGEOP_MAP, P(3), P(16), 4, PTE_P|PTE_U };
+	ops[2] = (struct Pageop) { PAGEOP_UNMAP, 0, P(1), 1, 0 };
+	if ((r = sys_page_batch(0, 0, ops, 3)) != -E_INVAL)
+		panic("sys_page_batch from unmapped page: got %e", r);
+	if (ops[0].po_npages != 0)
+		panic("op 0 has %d pages left", ops[0].po_npages);
+	if (ops[1].po_npages != 1 || ops[1].po_srcva != P(6)
+	    || ops[1].po_dstva != P(19))
+		panic("op 1 stopped at %d pages, %08x -> %08x",
+		      ops[1].po_npages, ops[1].po_srcva, ops[1].po_dstva);
+	if (ops[2].po_npages != 1 || ops[2].po_dstva != P(1))
+		panic("op 2 was touched");
+	for (i = 16; i < 19; i++)
+		if (!va_mapped(P(i)))
+			panic("P(%d) not mapped", i);
+	if (va_mapped(P(19)))
+		panic("P(19) mapped");
+	if (!va_mapped(P(1)))
+		panic("P(1) unmapped by an operation after the failure");
+	if (vpt[VPN(P(16))] & PTE_W)
+		panic("P(16) mapped writable");
+
+	cprintf("testbatch: OK\n");
+}
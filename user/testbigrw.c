@@ -0,0 +1,79 @@
+// Test reads and writes of several pages at once, which the file
+// server answers with multi-page IPC, and multi-page messages queued
+// for a receiver that isn't waiting yet.
+
+#include <inc/lib.h>
+
+#define FILE		"/bigrwtest"
+#define LEN		(5 * PGSIZE + 100)
+#define SENDVA		((char *) 0xD0000000)
+#define RECVVA		((char *) 0xD0100000)
+
+static char wbuf[LEN], rbuf[LEN];
+
+static void
+child(void)
+{
+	int r, i;
+
+	sys_sleep_until(sys_time_msec() + 100);
+	if ((r = sys_ipc_recv(IPC_NPAGES(RECVVA, 4))) < 0)
+		panic("child: sys_ipc_recv: %e", r);
+	if (env->env_ipc_value != 42 || env->env_ipc_npages != 3)
+		panic("child: got value %d with %d pages, not 42 with 3",
+		      env->env_ipc_value, env->env_ipc_npages);
+	for (i = 0; i < 3; i++)
+		if (RECVVA[i * PGSIZE] != 'a' + i)
+			panic("child: page %d says '%c'", i, RECVVA[i * PGSIZE]);
+	ipc_send(env->env_parent_id, 0, NULL, 0);
+	exit();
+}
+
+void
+umain(void)
+{
+	envid_t id;
+	int fd, r, i;
+
+	for (i = 0; i < LEN; i++)
+		wbuf[i] = i * 7 + i / PGSIZE;
+	if ((fd = open(FILE, O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open %s: %e", FILE, fd);
+	if ((r = write(fd, wbuf, LEN)) != LEN)
+		panic("write: %e", r);
+	if ((r = seek(fd, 0)) < 0)
+		panic("seek: %e", r);
+	if ((r = readn(fd, rbuf, LEN)) != LEN)
+		panic("readn: %e", r);
+	if (memcmp(rbuf, wbuf, LEN) != 0)
+		panic("read back something else");
+	if ((r = read(fd, rbuf, LEN)) != 0)
+		panic("read at end of file: got %e", r);
+	if ((r = seek(fd, PGSIZE + 50)) < 0)
+		panic("seek: %e", r);
+	if ((r = readn(fd, rbuf, 3 * PGSIZE)) != 3 * PGSIZE)
+		panic("readn at unaligned offset: %e", r);
+	if (memcmp(rbuf, wbuf + PGSIZE + 50, 3 * PGSIZE) != 0)
+		panic("read at unaligned offset got something else");
+	close(fd);
+	if ((r = remove(FILE)) < 0)
+		panic("remove: %e", r);
+
+	// Queue three pages for a child that isn't receiving yet.
+	for (i = 0; i < 3; i++) {
+		if ((r = sys_page_alloc(0, SENDVA + i * PGSIZE,
+					PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		SENDVA[i * PGSIZE] = 'a' + i;
+	}
+	if ((id = fork()) < 0)
+		panic("fork: %e", id);
+	if (id == 0)
+		child();
+	if ((r = sys_ipc_try_send(id, 42, IPC_NPAGES(SENDVA, 3),
+				  PTE_P|PTE_U)) < 0)
+		panic("sys_ipc_try_send: %e", r);
+	ipc_recv(NULL, NULL, NULL);
+
+	cprintf("testbigrw: OK\n");
+}
@@ -0,0 +1,68 @@
+// Test sys_fork: ordinary pages are copied on write, pages marked
+// PTE_SHARE stay shared, and a writable superpage is split so that it
+// too can be copied a page at a time.
+
+#include <inc/lib.h>
+
+#define SHAREVA		((char *) 0xD0000000)
+#define SUPERVA		((char *) 0xD0400000)
+
+volatile int cowvar = 1;
+
+void
+umain(void)
+{
+	envid_t child;
+	bool super;
+	int r;
+
+	if ((r = sys_page_alloc(0, SHAREVA, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+	strcpy(SHAREVA, "parent");
+
+	if ((r = sys_page_alloc_super(0, SUPERVA, PTE_P|PTE_U|PTE_W)) < 0
+	    && r != -E_INVAL)
+		panic("sys_page_alloc_super: %e", r);
+	if ((super = (r == 0))) {
+		SUPERVA[0] = 'p';
+		SUPERVA[PTSIZE - 1] = 'P';
+	} else
+		cprintf("no superpages, skipping that part\n");
+
+	if ((child = fork()) == 0) {
+		// The parent's writes after the fork don't show up here.
+		if (cowvar != 1)
+			panic("child: cowvar is %d, not 1", cowvar);
+		cowvar = 2;
+
+		if (strcmp(SHAREVA, "parent") != 0)
+			panic("child: shared page says '%s'", SHAREVA);
+		strcpy(SHAREVA, "child");
+
+		if (super) {
+			if (SUPERVA[0] != 'p' || SUPERVA[PTSIZE - 1] != 'P')
+				panic("child: superpage has '%c%c', not 'pP'",
+				      SUPERVA[0], SUPERVA[PTSIZE - 1]);
+			SUPERVA[PTSIZE - 1] = 'c';
+		}
+		ipc_send(env->env_parent_id, 0, NULL, 0);
+		exit();
+	}
+
+	cowvar = 3;
+	if (super) {
+		if (vpd[PDX(SUPERVA)] & PTE_PS)
+			panic("writable superpage not split by fork");
+		SUPERVA[0] = 'q';
+	}
+	ipc_recv(NULL, NULL, NULL);
+
+	if (cowvar != 3)
+		panic("parent: cowvar is %d, not 3", cowvar);
+	if (strcmp(SHAREVA, "child") != 0)
+		panic("parent: shared page says '%s', not 'child'", SHAREVA);
+	if (super && (SUPERVA[0] != 'q' || SUPERVA[PTSIZE - 1] != 'P'))
+		panic("parent: superpage has '%c%c', not 'qP'",
+		      SUPERVA[0], SUPERVA[PTSIZE - 1]);
+	cprintf("testfork: OK\n");
+}
@@ -0,0 +1,73 @@
+// Test mmap: writes to a MAP_SHARED mapping reach the file on msync or
+// munmap without undoing others' writes to the same page, and writes
+// to a MAP_PRIVATE mapping never do.
+
+#include <inc/lib.h>
+
+#define FILE		"/mmaptest"
+
+static char buf[2 * PGSIZE];
+
+static void
+check_file(int fd, off_t offset, char c)
+{
+	int r;
+
+	if ((r = seek(fd, offset)) < 0)
+		panic("seek: %e", r);
+	if ((r = readn(fd, buf, 1)) != 1)
+		panic("readn: %e", r);
+	if (buf[0] != c)
+		panic("file has '%c' at %d, not '%c'", buf[0], offset, c);
+}
+
+void
+umain(void)
+{
+	char *va;
+	int fd, r;
+
+	if ((fd = open(FILE, O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open %s: %e", FILE, fd);
+	memset(buf, 'a', sizeof(buf));
+	if ((r = write(fd, buf, sizeof(buf))) != sizeof(buf))
+		panic("write: %e", r);
+
+	// A shared write and a write through fd to the same page both stick.
+	va = NULL;
+	if ((r = mmap((void **) &va, 2 * PGSIZE, PROT_READ|PROT_WRITE,
+		      MAP_SHARED, fd, 0)) < 0)
+		panic("mmap shared: %e", r);
+	if (va[0] != 'a' || va[PGSIZE] != 'a')
+		panic("mapping doesn't show the file");
+	va[10] = 'X';
+	if ((r = seek(fd, 20)) < 0 || (r = write(fd, "Y", 1)) != 1)
+		panic("write Y: %e", r);
+	if ((r = msync(va, 2 * PGSIZE)) < 0)
+		panic("msync: %e", r);
+	check_file(fd, 10, 'X');
+	check_file(fd, 20, 'Y');
+	if (va[20] != 'Y')
+		panic("mapping doesn't show the write through fd after msync");
+
+	// Munmap writes back too.
+	va[PGSIZE + 5] = 'W';
+	if ((r = munmap(va, 2 * PGSIZE)) < 0)
+		panic("munmap: %e", r);
+	check_file(fd, PGSIZE + 5, 'W');
+
+	// A private write stays private.
+	va = NULL;
+	if ((r = mmap((void **) &va, 2 * PGSIZE, PROT_READ|PROT_WRITE,
+		      MAP_PRIVATE, fd, 0)) < 0)
+		panic("mmap private: %e", r);
+	va[30] = 'P';
+	if ((r = munmap(va, 2 * PGSIZE)) < 0)
+		panic("munmap private: %e", r);
+	check_file(fd, 30, 'a');
+
+	close(fd);
+	if ((r = remove(FILE)) < 0)
+		panic("remove: %e", r);
+	cprintf("testmmap: OK\n");
+}
@@ -0,0 +1,85 @@
+// Test read_map, which maps file-server pages straight into the
+// caller, and the multi-page IPC underneath it.
+
+#include <inc/lib.h>
+
+#define MAPVA		((char *) 0xD0000000)
+#define SENDVA		((char *) 0xD0100000)
+#define RECVVA		((char *) 0xD0200000)
+
+static char buf[2 * PGSIZE];
+
+static void
+child(void)
+{
+	int r, i;
+
+	if ((r = sys_ipc_recv(IPC_NPAGES(RECVVA, 2))) < 0)
+		panic("child: sys_ipc_recv: %e", r);
+	if (env->env_ipc_value != 42 || env->env_ipc_npages != 2)
+		panic("child: got value %d with %d pages, not 42 with 2",
+		      env->env_ipc_value, env->env_ipc_npages);
+	for (i = 0; i < 2; i++)
+		if (RECVVA[i * PGSIZE] != 'a' + i)
+			panic("child: page %d says '%c'", i, RECVVA[i * PGSIZE]);
+	ipc_send(env->env_parent_id, 0, NULL, 0);
+	exit();
+}
+
+void
+umain(void)
+{
+	struct Stat st;
+	void *srcvas[3];
+	envid_t id;
+	ssize_t n;
+	int fd, r, i;
+
+	if ((fd = open("/init", O_RDONLY)) < 0)
+		panic("open /init: %e", fd);
+	if ((r = fstat(fd, &st)) < 0)
+		panic("fstat: %e", r);
+	n = MIN(st.st_size, 2 * PGSIZE);
+
+	if ((r = read_map(fd, 0, MAPVA, n)) != n)
+		panic("read_map returned %e, not %d", r, n);
+	if ((r = readn(fd, buf, n)) != n)
+		panic("readn: %e", r);
+	if (memcmp(MAPVA, buf, n) != 0)
+		panic("read_map and readn disagree");
+	for (i = 0; i < n; i += PGSIZE)
+		if (vpt[VPN(MAPVA + i)] & PTE_W)
+			panic("read_map page %d is writable", i / PGSIZE);
+	if ((r = read_map(fd, 100, MAPVA, PGSIZE)) != -E_INVAL)
+		panic("read_map at unaligned offset: got %e", r);
+	if ((r = read_map(fd, ROUNDUP(st.st_size, PGSIZE), MAPVA, PGSIZE)) != 0)
+		panic("read_map past end of file: got %e", r);
+	close(fd);
+
+	// Hand pages to a child receiving two at a time.
+	for (i = 0; i < 3; i++) {
+		srcvas[i] = SENDVA + i * PGSIZE;
+		if ((r = sys_page_alloc(0, srcvas[i], PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		SENDVA[i * PGSIZE] = 'a' + i;
+	}
+	if ((id = fork()) < 0)
+		panic("fork: %e", id);
+	if (id == 0)
+		child();
+
+	while ((r = sys_ipc_send_pages(id, 42, srcvas, 3, PTE_P|PTE_U))
+	       == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r != -E_INVAL)
+		panic("sending 3 pages to a receiver of 2: got %e", r);
+	srcvas[1] = MAPVA + 64 * PGSIZE;
+	if ((r = sys_ipc_send_pages(id, 42, srcvas, 2, PTE_P|PTE_U)) != -E_INVAL)
+		panic("sending an unmapped page: got %e", r);
+	srcvas[1] = SENDVA + PGSIZE;
+	if ((r = sys_ipc_send_pages(id, 42, srcvas, 2, PTE_P|PTE_U)) < 0)
+		panic("sys_ipc_send_pages: %e", r);
+	ipc_recv(NULL, NULL, NULL);
+
+	cprintf("testreadmap: OK\n");
+}
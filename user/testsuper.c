@@ -0,0 +1,68 @@
+// Test sys_page_alloc_super: a superpage is mapped with PTE_PS and
+// zeroed, and unmapping or remapping one of its pages in place splits
+// it without disturbing the rest.
+
+#include <inc/lib.h>
+
+#define SUPERVA		((char *) 0xD0400000)
+#define MID		(SUPERVA + 512 * PGSIZE)
+#define RO		(SUPERVA + 3 * PGSIZE)
+
+void
+umain(void)
+{
+	struct Pageop op;
+	int i, r;
+
+	if ((r = sys_page_alloc_super(0, SUPERVA + PGSIZE, PTE_P|PTE_U|PTE_W))
+	    != -E_INVAL)
+		panic("misaligned sys_page_alloc_super: got %e", r);
+	if ((r = sys_page_alloc_super(0, SUPERVA, PTE_P|PTE_U|PTE_W)) == -E_INVAL) {
+		cprintf("no superpages, skipping\n");
+		cprintf("testsuper: OK\n");
+		return;
+	} else if (r < 0)
+		panic("sys_page_alloc_super: %e", r);
+
+	if (!(vpd[PDX(SUPERVA)] & PTE_PS))
+		panic("superpage not mapped with PTE_PS");
+	for (i = 0; i < PTSIZE; i += PGSIZE / 4)
+		if (SUPERVA[i] != 0)
+			panic("superpage not zeroed at +%x", i);
+	for (i = 0; i < NPTENTRIES; i++)
+		*(int *) (SUPERVA + i * PGSIZE) = i;
+
+	// Unmapping a page in the middle splits the superpage.
+	if ((r = sys_page_unmap(0, MID)) < 0)
+		panic("sys_page_unmap: %e", r);
+	if (vpd[PDX(SUPERVA)] & PTE_PS)
+		panic("superpage not split by sys_page_unmap");
+	if (vpt[VPN(MID)] & PTE_P)
+		panic("unmapped page still mapped");
+	for (i = 0; i < NPTENTRIES; i++)
+		if (SUPERVA + i * PGSIZE != MID
+		    && *(int *) (SUPERVA + i * PGSIZE) != i)
+			panic("page %d lost its data in the split", i);
+
+	// So does remapping one read-only in place, in a fresh superpage.
+	op = (struct Pageop) { PAGEOP_UNMAP, 0, SUPERVA, NPTENTRIES, 0 };
+	if ((r = sys_page_batch(0, 0, &op, 1)) < 0)
+		panic("sys_page_batch: %e", r);
+	if ((r = sys_page_alloc_super(0, SUPERVA, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc_super again: %e", r);
+	for (i = 0; i < NPTENTRIES; i++)
+		*(int *) (SUPERVA + i * PGSIZE) = i;
+	if ((r = sys_page_map(0, RO, 0, RO, PTE_P|PTE_U)) < 0)
+		panic("sys_page_map: %e", r);
+	if (vpd[PDX(SUPERVA)] & PTE_PS)
+		panic("superpage not split by sys_page_map");
+	if ((vpt[VPN(RO)] & (PTE_P|PTE_W)) != PTE_P)
+		panic("page not remapped read-only");
+	for (i = 0; i < NPTENTRIES; i++)
+		if (*(int *) (SUPERVA + i * PGSIZE) != i)
+			panic("page %d lost its data in the split", i);
+	if (!(vpt[VPN(MID)] & PTE_W))
+		panic("rest of the superpage no longer writable");
+
+	cprintf("testsuper: OK\n");
+}